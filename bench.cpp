@@ -0,0 +1,233 @@
+//
+// bench.cpp
+//
+#include "kernel.h"
+
+#include "mt19937ar.h"
+#include "output_file.h"
+#include "statistics.h"
+
+#define DRIVE        "SD:"
+
+#define BENCH_MAX_FREQS  16
+#define BENCH_MAX_BATCH  256
+
+// Keeps results of pure computations alive
+static volatile u32 s_BenchSink;
+
+// Generic timer counter; GetClockTicks64 counts microseconds, too coarse for a batch of computations
+static inline u64 ReadCounter() {
+#if AARCH == 64
+  u64 value;
+  asm volatile ("isb; mrs %0, cntvct_el0" : "=r" (value));
+  return value;
+#elif AARCH == 32
+  u32 low, high;
+  asm volatile ("isb; mrrc p15, 1, %0, %1, c14" : "=r" (low), "=r" (high));
+  return static_cast<u64>(high) << 32 | low;
+#else
+  return CTimer::GetClockTicks64();
+#endif
+}
+
+static inline u64 CounterFrequency() {
+#if AARCH == 64
+  u64 value;
+  asm volatile ("mrs %0, cntfrq_el0" : "=r" (value));
+  return value;
+#elif AARCH == 32
+  u32 value;
+  asm volatile ("mrc p15, 0, %0, c14, c0, 0" : "=r" (value));
+  return value;
+#else
+  return CLOCKHZ;
+#endif
+}
+
+// Runs operation batchSize times per sample and stores the time per operation in ns
+// settle runs untimed after every operation (e.g. to wait for the chip); a failed settle counts as a failure
+// Returns the number of failed operations
+template <typename TOperation, typename TSettle>
+static unsigned TimeBatches(u64* samples, const unsigned batches, const unsigned batchSize, TOperation operation,
+                            TSettle settle) {
+  const u64 frequency = CounterFrequency();
+  unsigned failed = 0;
+  for (unsigned b = 0; b < batches; ++b) {
+    u64 ticks = 0;
+    for (unsigned i = 0; i < batchSize; ++i) {
+      const u64 start = ReadCounter();
+      const bool ok = operation(i);
+      ticks += ReadCounter() - start;
+      if (!ok || !settle(i)) ++failed;
+    }
+    samples[b] = ticks * 1000000000 / frequency / batchSize;
+  }
+  return failed;
+}
+
+template <typename TOperation>
+static unsigned TimeBatches(u64* samples, const unsigned batches, const unsigned batchSize, TOperation operation) {
+  const u64 frequency = CounterFrequency();
+  unsigned failed = 0;
+  for (unsigned b = 0; b < batches; ++b) {
+    const u64 start = ReadCounter();
+    for (unsigned i = 0; i < batchSize; ++i) {
+      if (!operation(i)) ++failed;
+    }
+    samples[b] = (ReadCounter() - start) * 1000000000 / frequency / batchSize;
+  }
+  return failed;
+}
+
+MeasurementResult CKernel::BenchMode() {
+  MeasurementResult result = Okay;
+
+#define FILENAME_BENCH MEM_NAME_SIMPLE "_%d_bench.csv"
+  const CString fileName = GetFreeFile(DRIVE FILENAME_BENCH);
+  const char* cFileName = fileName;
+  m_Logger.Write(FromKernel, LogNotice, "Choosing bench file %s", cFileName);
+
+  unsigned freqs[BENCH_MAX_FREQS];
+  unsigned freqCount = ParseNumberList(GetParamString("bench_freqs", ""), freqs, BENCH_MAX_FREQS);
+  if (freqCount == 0) {
+    freqs[0] = MEM_SPI_FREQ_DEFAULT;
+    freqCount = 1;
+  }
+  for (unsigned f = 0; f < freqCount; ++f) {
+    if (freqs[f] > MEM_SPI_FREQ_MAX) {
+      m_Logger.Write(FromKernel, LogWarning, "Bench frequency %u Hz exceeds the maximum of %u Hz for this memory",
+                     freqs[f], MEM_SPI_FREQ_MAX);
+    }
+  }
+  unsigned batchSize = GetParamNumber("bench_batch", 100);
+  if (batchSize == 0) batchSize = 1;
+  if (batchSize > BENCH_MAX_BATCH) batchSize = BENCH_MAX_BATCH;
+  unsigned batches = GetParamNumber("bench_iterations", 10000) / batchSize;
+  if (batches == 0) batches = 1;
+  m_Logger.Write(FromKernel, LogNotice, "Bench: %u frequencies, %u batches of %u operations",
+                 freqCount, batches, batchSize);
+
+  const auto samples = m_Arena.Allocate<u64>(batches);
+  if (samples == nullptr) return ArenaExhausted("bench samples", batches * sizeof(u64));
+
+  COutputFile file;
+  FRESULT Result = file.Open(fileName, 16 * 1024);
+  if (Result != FR_OK) {
+    m_Logger.Write(FromKernel, LogPanic, "Cannot create file: %s (%d)", cFileName, Result);
+    return FailedTotally;
+  }
+  file.Write("name,spi_freq,iterations,failed,median_ns,p99_ns,mean_ns,ops_per_s,spi_bytes_per_s\n");
+
+  u32 addrs[BENCH_MAX_BATCH];
+  u8 values[BENCH_MAX_BATCH];
+  CString Msg;
+
+  // spiBytes is the number of bytes on the bus per operation (0 if it varies or there is no SPI traffic)
+  auto writeRow = [&](const char* name, const unsigned freq, const unsigned failed, const unsigned spiBytes) {
+    TLatencyStatistics stats;
+    ComputeStatistics(stats, samples, batches);
+    const u64 opsPerSecond = stats.Mean > 0 ? static_cast<u64>(1e9 / stats.Mean) : 0;
+    Msg.Format("%s,%u,%u,%u,%llu,%llu,%llu,%llu,%llu\n", name, freq, batches * batchSize, failed,
+               stats.Median, stats.P99, static_cast<u64>(stats.Mean), opsPerSecond, opsPerSecond * spiBytes);
+    if (file.Write(Msg) != FR_OK) result = FailedPartially;
+    m_Logger.Write(FromKernel, LogNotice, "%s @ %u Hz: median %llu ns, p99 %llu ns",
+                   name, freq, stats.Median, stats.P99);
+  };
+  auto randomizeBatch = [&]() {
+    for (unsigned i = 0; i < batchSize; ++i) {
+      addrs[i] = genrand_range(0, MEM_SIZE_ADR);
+      values[i] = static_cast<u8>(genrand_range(0, 256));
+    }
+  };
+
+  // Kernel stages without SPI traffic
+  u32 sink = 0;
+  TimeBatches(samples, batches, batchSize, [&](unsigned i) {
+    const MemoryStatusRegister reg = ParseStatusRegister(static_cast<u8>(i));
+    sink += reg.WriteInProgressBit + reg.BlockProtectionBits;
+    return true;
+  });
+  writeRow("parse_status", 0, 0, 0);
+  TimeBatches(samples, batches, batchSize, [&](unsigned) {
+    sink += genrand_range(0, MEM_SIZE_ADR);
+    return true;
+  });
+  writeRow("genrand_range", 0, 0, 0);
+  s_BenchSink = sink;
+
+  const TSPIClockProfile profile = m_SPIClocks;
+  for (unsigned f = 0; f < freqCount && result == Okay; ++f) {
+    const unsigned freq = freqs[f];
+    m_SPIClocks = {freq, freq, freq, freq};
+    unsigned failed;
+
+    TimeBatches(samples, batches, batchSize, [&](unsigned) {
+      SetWriteEnableLatch(false);
+      return true;
+    });
+    writeRow("wren", freq, 0, 1);
+
+    // MemWrite always sets the write enable latch first; the chip ignores writes while WIP is set,
+    // so every write is completed (untimed) before the next one
+    randomizeBatch();
+    failed = TimeBatches(samples, batches, batchSize, [&](unsigned i) {
+      MemWrite(addrs[i], values[i]);
+      return true;
+    }, [&](unsigned) {
+      u64 cycles;
+      return WIPPollingCycles(cycles, 1000) == Okay;
+    });
+    writeRow("wren_wr", freq, failed, 1 + 1 + MEM_ADR_SEND + 1);
+
+    TimeBatches(samples, batches, batchSize, [&](unsigned) {
+      MemoryStatusRegister reg;
+      ReadStatusRegister(&reg);
+      return true;
+    });
+    writeRow("rdsr", freq, 0, 2);
+
+    randomizeBatch();
+    TimeBatches(samples, batches, batchSize, [&](unsigned i) {
+      s_BenchSink = MemRead(addrs[i]);
+      return true;
+    });
+    writeRow("read", freq, 0, 1 + MEM_ADR_SEND + 1);
+
+    randomizeBatch();
+    failed = TimeBatches(samples, batches, batchSize, [&](unsigned i) {
+      u64 cycles;
+      return MemWriteAndPoll(cycles, addrs[i], values[i], 1000) == Okay;
+    });
+    writeRow("write_and_poll", freq, failed, 0);
+
+    failed = TimeBatches(samples, batches, batchSize, [&](unsigned) {
+      u64 latency;
+      return RandomWriteLatency(latency, 1000) == Okay;
+    });
+    writeRow("random_write_latency", freq, failed, 0);
+
+    failed = TimeBatches(samples, batches, batchSize, [&](unsigned) {
+      u64 latency;
+      return ChainedWriteLatency(latency, 1000) == Okay;
+    });
+    writeRow("chained_write_latency", freq, failed, 0);
+
+    failed = TimeBatches(samples, batches, batchSize, [&](unsigned) {
+      bool bit;
+      int raw = 0;
+      return ExtractSingleBit(bit, raw, 1000, 1000) == Okay;
+    });
+    writeRow("extract_bit", freq, failed, 0);
+  }
+  m_SPIClocks = profile;
+
+  Result = file.Close();
+  if (Result == FR_OK) {
+    m_Logger.Write(FromKernel, LogNotice, "Successfully written bench results to %s!", cFileName);
+  } else {
+    m_Logger.Write(FromKernel, LogPanic, "Cannot close bench file (%d)", Result);
+    result = FailedPartially;
+  }
+
+  return result;
+}
@@ -0,0 +1,118 @@
+//
+// burnout.cpp
+//
+#include "kernel.h"
+
+#define DRIVE        "SD:"
+
+#define BURNOUT_BURST                1024       // Stress writes per cell before moving on to the next one
+#define BURNOUT_SAVE_INTERVAL_US     60000000   // Progress is saved at least once per minute
+
+// Every bit switches with every write, the worst case for the cell
+static constexpr u8 s_Patterns[] = {0x00, 0xFF};
+
+// Writes both stress patterns and reads them back; a stuck bit fails one of them
+MeasurementResult CKernel::VerifyStressPatterns(bool& stuck, const u32 addr, const int timeout) {
+  u64 temp;
+  stuck = false;
+  for (const u8 pattern : s_Patterns) {
+    const MeasurementResult result = MemWriteAndPoll(temp, addr, pattern, timeout);
+    if (result != Okay) return result;
+    if (MemRead(addr) != pattern) stuck = true;
+  }
+  return Okay;
+}
+
+MeasurementResult CKernel::BurnOutCampaign(const u32* cells, const unsigned count, const int timeout) {
+  if (count > BURNOUT_MAX_CELLS) {
+    m_Logger.Write(FromKernel, LogError, "Burn-out campaign of %u cells, at most %u are supported", count,
+                   BURNOUT_MAX_CELLS);
+    return FailedTotally;
+  }
+  if (count == 0) {
+    m_Logger.Write(FromKernel, LogNotice, "Burn-out campaign: no cells to stress");
+    return Okay;
+  }
+
+  CBurnOutCampaign campaign(cells, count, GetParamNumber("burnout_check_min", 100),
+                            GetParamNumber("burnout_check_max", 100000), GetBoardSerial());
+
+  CString fileName;
+  fileName.Format(DRIVE "%s", GetParamString("burnout_file", MEM_NAME_SIMPLE "_burnout.bin"));
+  const char* cFileName = fileName;
+  FRESULT Result = campaign.Load(cFileName);
+  if (Result != FR_OK) {
+    m_Logger.Write(FromKernel, LogWarning, "Cannot resume burn-out campaign from %s (%d), starting over",
+                   cFileName, Result);
+  }
+
+  // Cells that are burnt out already (e.g. by an earlier campaign without a progress file) need no stress
+  bool burntOut;
+  for (unsigned i = 0; i < campaign.GetCellCount(); ++i) {
+    if (campaign.IsBurntOut(i) || campaign.GetCell(i).Writes > 0) continue;
+    const MeasurementResult result = IsBurntOut(burntOut, static_cast<int>(campaign.GetCell(i).Address), 10, timeout);
+    if (result != Okay) return result;
+    if (burntOut) campaign.RecordCheck(i, true);
+  }
+  m_Logger.Write(FromKernel, LogNotice, "Burn-out campaign: %u of %u cells to go",
+                 campaign.GetPending(), campaign.GetCellCount());
+
+  u64 lastSave = CTimer::GetClockTicks64();
+  bool saveNow = false;
+  u64 temp;
+  while (campaign.GetPending() > 0) {
+    // Interleaved: a burst for every pending cell per round
+    for (unsigned i = 0; i < campaign.GetCellCount(); ++i) {
+      if (campaign.IsBurntOut(i)) continue;
+      const u32 addr = campaign.GetCell(i).Address;
+
+      u64 burst = campaign.GetWritesUntilCheck(i);
+      if (burst > BURNOUT_BURST) burst = BURNOUT_BURST;
+      for (u64 j = 0; j < burst; ++j) {
+        const u8 pattern = s_Patterns[(campaign.GetCell(i).Writes + j) & 1];
+        const MeasurementResult result = MemWriteAndPoll(temp, addr, pattern, timeout);
+        if (result != Okay) {
+          campaign.Save(cFileName);
+          return result;
+        }
+      }
+      campaign.RecordWrites(i, burst);
+      if (campaign.GetWritesUntilCheck(i) > 0) continue;
+
+      bool stuck;
+      MeasurementResult result = VerifyStressPatterns(stuck, addr, timeout);
+      campaign.RecordWrites(i, 2);
+      // Confirmed with random values, like every other burn-out check
+      if (result == Okay && stuck) result = IsBurntOut(burntOut, static_cast<int>(addr), 10, timeout);
+      if (result != Okay) {
+        campaign.Save(cFileName);
+        return result;
+      }
+      campaign.RecordCheck(i, stuck && burntOut);
+      if (campaign.IsBurntOut(i)) {
+        m_Logger.Write(FromKernel, LogNotice, "Cell %u burnt out after %llu writes (%u checks), %u cells to go",
+                       addr, campaign.GetCell(i).BurntAt, campaign.GetCell(i).Checks, campaign.GetPending());
+        saveNow = true;
+      }
+    }
+
+    if (saveNow || CTimer::GetClockTicks64() - lastSave >= BURNOUT_SAVE_INTERVAL_US) {
+      Result = campaign.Save(cFileName);
+      if (Result != FR_OK) {
+        m_Logger.Write(FromKernel, LogWarning, "Cannot save burn-out progress to %s (%d)", cFileName, Result);
+      }
+      lastSave = CTimer::GetClockTicks64();
+      saveNow = false;
+      u64 writes = 0;
+      for (unsigned i = 0; i < campaign.GetCellCount(); ++i) writes += campaign.GetCell(i).Writes;
+      m_Logger.Write(FromKernel, LogNotice, "Burn-out campaign: %llu writes, %u cells to go, expected onset %llu",
+                     writes, campaign.GetPending(), campaign.GetExpectedOnset());
+    }
+  }
+
+  Result = campaign.Save(cFileName);
+  if (Result != FR_OK) {
+    m_Logger.Write(FromKernel, LogWarning, "Cannot save burn-out progress to %s (%d)", cFileName, Result);
+  }
+  return Okay;
+}
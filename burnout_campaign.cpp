@@ -0,0 +1,190 @@
+//
+// burnout_campaign.cpp
+//
+#include "burnout_campaign.h"
+
+#include <circle/util.h>
+
+// <file>.tmp
+static bool GetTempName(char* pBuffer, const unsigned nSize, const char* pFileName) {
+  const unsigned nLength = strlen(pFileName);
+  if (nLength + 5 > nSize) return false;
+  memcpy(pBuffer, pFileName, nLength);
+  memcpy(pBuffer + nLength, ".tmp", 5);
+  return true;
+}
+
+CBurnOutCampaign::CBurnOutCampaign(const u32* pCells, const unsigned nCount, const unsigned nMinInterval,
+                                   const unsigned nMaxInterval, const u64 nBoard)
+  : m_nCells(nCount < BURNOUT_MAX_CELLS ? nCount : BURNOUT_MAX_CELLS),
+    m_nMinInterval(nMinInterval > 0 ? nMinInterval : 1),
+    m_nMaxInterval(nMaxInterval > nMinInterval ? nMaxInterval : m_nMinInterval),
+    m_nBoard(nBoard) {
+  memset(m_Cells, 0, sizeof(m_Cells));
+  for (unsigned i = 0; i < m_nCells; ++i) {
+    m_Cells[i].Address = pCells[i];
+    m_Cells[i].NextCheck = m_nMinInterval;
+  }
+}
+
+unsigned CBurnOutCampaign::GetPending() const {
+  unsigned nPending = 0;
+  for (unsigned i = 0; i < m_nCells; ++i) {
+    if (!IsBurntOut(i)) ++nPending;
+  }
+  return nPending;
+}
+
+void CBurnOutCampaign::RecordCheck(const unsigned nCell, const bool bBurntOut) {
+  TBurnOutCell& cell = m_Cells[nCell];
+  ++cell.Checks;
+  if (bBurntOut) {
+    // A cell that was already burnt out before its first stress write still counts as one write
+    cell.BurntAt = cell.Writes > 0 ? cell.Writes : 1;
+    return;
+  }
+  cell.NextCheck = cell.Writes + PlanInterval(cell);
+}
+
+u64 CBurnOutCampaign::GetExpectedOnset() const {
+  u64 nSum = 0;
+  unsigned nCount = 0;
+  for (unsigned i = 0; i < m_nCells; ++i) {
+    if (IsBurntOut(i)) {
+      nSum += m_Cells[i].BurntAt;
+      ++nCount;
+    }
+  }
+  return nCount > 0 ? nSum / nCount : 0;
+}
+
+u64 CBurnOutCampaign::PlanInterval(const TBurnOutCell& cell) const {
+  const u64 nOnset = GetExpectedOnset();
+  u64 nInterval;
+  if (nOnset == 0) {
+    nInterval = m_nMinInterval;
+    for (u32 i = 0; i < cell.Checks && nInterval < m_nMaxInterval; ++i) nInterval *= 2;
+  } else if (cell.Writes < nOnset) {
+    nInterval = (nOnset - cell.Writes) / 4;
+  } else {
+    // Outlasted the others: back off with the overshoot
+    nInterval = (cell.Writes - nOnset) / 4;
+  }
+  if (nInterval < m_nMinInterval) nInterval = m_nMinInterval;
+  if (nInterval > m_nMaxInterval) nInterval = m_nMaxInterval;
+  return nInterval;
+}
+
+FRESULT CBurnOutCampaign::OpenStored(FIL* pFile, const char* pFileName, TBurnOutHeader* pHeader) const {
+  FRESULT Result = f_open(pFile, pFileName, FA_READ | FA_OPEN_EXISTING);
+  if (Result == FR_NO_FILE) {
+    // Save removes the file only once the temporary file is complete
+    char tempName[256];
+    if (!GetTempName(tempName, sizeof(tempName), pFileName)) return FR_INVALID_NAME;
+    Result = f_rename(tempName, pFileName);
+    if (Result != FR_OK) return Result;
+    Result = f_open(pFile, pFileName, FA_READ | FA_OPEN_EXISTING);
+  }
+  if (Result != FR_OK) return Result;
+
+  unsigned nBytesRead;
+  Result = f_read(pFile, pHeader, sizeof(*pHeader), &nBytesRead);
+  if (Result == FR_OK && (nBytesRead != sizeof(*pHeader) || memcmp(pHeader->Magic, BURNOUT_MAGIC, 4) != 0
+                          || pHeader->Version != BURNOUT_VERSION || pHeader->MemType != MEM_TYPE
+                          || pHeader->Board != m_nBoard)) {
+    Result = FR_INVALID_OBJECT;
+  }
+  if (Result != FR_OK) f_close(pFile);
+  return Result;
+}
+
+bool CBurnOutCampaign::HasCell(const u32 nAddress) const {
+  for (unsigned i = 0; i < m_nCells; ++i) {
+    if (m_Cells[i].Address == nAddress) return true;
+  }
+  return false;
+}
+
+FRESULT CBurnOutCampaign::Load(const char* pFileName) {
+  FIL file;
+  TBurnOutHeader header;
+  FRESULT Result = OpenStored(&file, pFileName, &header);
+  if (Result == FR_NO_FILE) return FR_OK;
+  if (Result != FR_OK) return Result;
+
+  unsigned nBytesRead;
+  for (unsigned i = 0; Result == FR_OK && i < header.Cells; ++i) {
+    TBurnOutCell stored;
+    Result = f_read(&file, &stored, sizeof(stored), &nBytesRead);
+    if (Result == FR_OK && nBytesRead != sizeof(stored)) Result = FR_INVALID_OBJECT;
+    for (unsigned j = 0; j < m_nCells && Result == FR_OK; ++j) {
+      if (m_Cells[j].Address == stored.Address) m_Cells[j] = stored;
+    }
+  }
+
+  const FRESULT CloseResult = f_close(&file);
+  return Result != FR_OK ? Result : CloseResult;
+}
+
+FRESULT CBurnOutCampaign::Save(const char* pFileName) const {
+  char tempName[256];
+  if (!GetTempName(tempName, sizeof(tempName), pFileName)) return FR_INVALID_NAME;
+
+  // Cells of other campaigns (e.g. other raw shards) stored in the file are kept
+  FIL stored;
+  TBurnOutHeader storedHeader;
+  FRESULT Result = OpenStored(&stored, pFileName, &storedHeader);
+  const bool bMerge = Result == FR_OK;
+  if (!bMerge && Result != FR_NO_FILE && Result != FR_INVALID_OBJECT) return Result;
+
+  FIL file;
+  Result = f_open(&file, tempName, FA_WRITE | FA_CREATE_ALWAYS);
+  if (Result != FR_OK) {
+    if (bMerge) f_close(&stored);
+    return Result;
+  }
+
+  TBurnOutHeader header = {
+    {BURNOUT_MAGIC[0], BURNOUT_MAGIC[1], BURNOUT_MAGIC[2], BURNOUT_MAGIC[3]},
+    BURNOUT_VERSION,
+    static_cast<u16>(m_nCells),
+    MEM_TYPE,
+    m_nBoard
+  };
+  unsigned nBytesWritten;
+  Result = f_write(&file, &header, sizeof(header), &nBytesWritten);
+  if (Result == FR_OK && nBytesWritten != sizeof(header)) Result = FR_DENIED;
+  if (Result == FR_OK) {
+    Result = f_write(&file, m_Cells, m_nCells * sizeof(TBurnOutCell), &nBytesWritten);
+    if (Result == FR_OK && nBytesWritten != m_nCells * sizeof(TBurnOutCell)) Result = FR_DENIED; // Disk full
+  }
+
+  if (bMerge) {
+    for (unsigned i = 0; Result == FR_OK && i < storedHeader.Cells && header.Cells < 0xFFFF; ++i) {
+      TBurnOutCell cell;
+      unsigned nBytesRead;
+      Result = f_read(&stored, &cell, sizeof(cell), &nBytesRead);
+      if (Result != FR_OK || nBytesRead != sizeof(cell)) break; // A truncated file keeps the complete records
+      if (HasCell(cell.Address)) continue;
+      Result = f_write(&file, &cell, sizeof(cell), &nBytesWritten);
+      if (Result == FR_OK && nBytesWritten != sizeof(cell)) Result = FR_DENIED;
+      ++header.Cells;
+    }
+    f_close(&stored);
+    if (Result == FR_OK && header.Cells != m_nCells) {
+      Result = f_lseek(&file, 0);
+      if (Result == FR_OK) Result = f_write(&file, &header, sizeof(header), &nBytesWritten);
+      if (Result == FR_OK && nBytesWritten != sizeof(header)) Result = FR_DENIED;
+    }
+  }
+
+  const FRESULT CloseResult = f_close(&file);
+  if (Result == FR_OK) Result = CloseResult;
+  if (Result != FR_OK) return Result;
+
+  // Keeps the previous state if the power is cut while writing; Load falls back to the temporary
+  // file if it is cut between unlink and rename
+  Result = f_unlink(pFileName);
+  if (Result != FR_OK && Result != FR_NO_FILE) return Result;
+  return f_rename(tempName, pFileName);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <circle/types.h>
+#include <fatfs/ff.h>
+
+#define BURNOUT_MAGIC        "BURN"
+#define BURNOUT_VERSION      2
+#define BURNOUT_MAX_CELLS    256 // Every cell of the raw sweeps (RAW_MAX_SWEEPS * RAW_MAX_CELLS) fits
+
+// Header of a persisted campaign, followed by Cells TBurnOutCell records
+struct TBurnOutHeader {
+  char Magic[4];
+  u16 Version;
+  u16 Cells;
+  u32 MemType;
+  u64 Board;       // Serial number of the board the chip is wired to
+} __attribute__((packed));
+
+struct TBurnOutCell {
+  u32 Address;
+  u32 Checks;      // Verifications so far
+  u64 Writes;      // Stress writes so far
+  u64 NextCheck;   // Verify once Writes reaches this
+  u64 BurntAt;     // Writes when the failure was detected (0: not yet)
+} __attribute__((packed));
+
+/**
+ * State of a burn-out campaign over several cells and the schedule of their verifications.
+ * Until the first cell fails, the verification interval of every cell doubles after each check; afterwards
+ * the mean detected failure onset is known and each cell is checked a quarter of its remaining distance
+ * to it ahead (clamped to [min, max]), so checks are rare early on and dense around the expected failure.
+ */
+class CBurnOutCampaign {
+public:
+  CBurnOutCampaign(const u32* pCells, unsigned nCount, unsigned nMinInterval, unsigned nMaxInterval, u64 nBoard);
+
+  unsigned GetCellCount() const {
+    return m_nCells;
+  }
+
+  const TBurnOutCell& GetCell(const unsigned nCell) const {
+    return m_Cells[nCell];
+  }
+
+  bool IsBurntOut(const unsigned nCell) const {
+    return m_Cells[nCell].BurntAt != 0;
+  }
+
+  // Number of cells that are not burnt out yet
+  unsigned GetPending() const;
+
+  u64 GetWritesUntilCheck(const unsigned nCell) const {
+    const TBurnOutCell& cell = m_Cells[nCell];
+    return cell.NextCheck > cell.Writes ? cell.NextCheck - cell.Writes : 0;
+  }
+
+  void RecordWrites(const unsigned nCell, const u64 nWrites) {
+    m_Cells[nCell].Writes += nWrites;
+  }
+
+  // Records the result of a verification and schedules the next one
+  void RecordCheck(unsigned nCell, bool bBurntOut);
+
+  // Mean number of writes after which the failure of a cell was detected (0: no cell failed yet)
+  u64 GetExpectedOnset() const;
+
+  // Resumes the cells stored in the file (matched by address) or its temporary file, if a save was cut off
+  // before the rename; a missing file is not an error, a mismatching one (e.g. of another board, as an
+  // SD card may be moved between boards) is FR_INVALID_OBJECT
+  FRESULT Load(const char* pFileName);
+
+  // Replaces the file (written to a temporary file first); the stored cells of other campaigns of this board
+  // are kept
+  FRESULT Save(const char* pFileName) const;
+
+private:
+  // Opens the file positioned after its checked header, completing a save that was cut off before the rename
+  FRESULT OpenStored(FIL* pFile, const char* pFileName, TBurnOutHeader* pHeader) const;
+
+  bool HasCell(u32 nAddress) const;
+
+  u64 PlanInterval(const TBurnOutCell& cell) const;
+
+private:
+  unsigned m_nCells;
+  TBurnOutCell m_Cells[BURNOUT_MAX_CELLS];
+  u64 m_nMinInterval;
+  u64 m_nMaxInterval;
+  u64 m_nBoard;
+};
@@ -0,0 +1,114 @@
+//
+// entropy_pool.cpp
+//
+#include "entropy_pool.h"
+
+#include <circle/util.h>
+
+static u64 Rotl(const u64 x, const int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+static u64 SplitMix64(u64 x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+CEntropyPool::CEntropyPool()
+  : m_nIn(0),
+    m_nOut(0),
+    m_State{SplitMix64(1), SplitMix64(2), SplitMix64(3), SplitMix64(4)},
+    m_nMixIndex(0),
+    m_nAccumulator(0),
+    m_nAccumulated(0),
+    m_bStale(false),
+    m_nEntropyBits(0),
+    m_nBytesDelivered(0) {}
+
+CEntropyPool::~CEntropyPool() = default;
+
+void CEntropyPool::Initialize() {
+  Refill();
+}
+
+void CEntropyPool::AddBit(const bool bit) {
+  m_nAccumulator = m_nAccumulator << 1 | static_cast<u64>(bit);
+  if (++m_nAccumulated == 64) {
+    Mix(m_nAccumulator);
+    m_nAccumulator = 0;
+    m_nAccumulated = 0;
+    m_nEntropyBits += 64;
+    if (m_nEntropyBits > ENTROPY_POOL_STATE_BITS) m_nEntropyBits = ENTROPY_POOL_STATE_BITS;
+    // Output generated from the old state is dropped by the next GetBytes, once for any number of reseeds
+    m_bStale = true;
+  }
+}
+
+void CEntropyPool::AddWord(const u32 word) {
+  Mix(word);
+}
+
+unsigned CEntropyPool::GetBytes(void* pBuffer, const unsigned nCount) {
+  if (m_bStale) {
+    m_nOut = m_nIn;
+    m_bStale = false;
+  }
+
+  auto* pOut = static_cast<u8*>(pBuffer);
+  for (unsigned i = 0; i < nCount; ++i) {
+    if (m_nIn == m_nOut) Refill();
+    pOut[i] = m_Buffer[m_nOut++ & (ENTROPY_POOL_SIZE - 1)];
+  }
+
+  m_nEntropyBits = m_nEntropyBits > 8 * nCount ? m_nEntropyBits - 8 * nCount : 0;
+  m_nBytesDelivered += nCount;
+
+  return nCount;
+}
+
+unsigned CEntropyPool::GetFillLevel() const {
+  return m_nIn - m_nOut;
+}
+
+unsigned CEntropyPool::GetEntropyBits() const {
+  return m_nEntropyBits;
+}
+
+u64 CEntropyPool::GetBytesDelivered() const {
+  return m_nBytesDelivered;
+}
+
+void CEntropyPool::Refill() {
+  while (ENTROPY_POOL_SIZE - (m_nIn - m_nOut) >= sizeof(u64)) {
+    u64 value = Next();
+    for (unsigned i = 0; i < sizeof(u64); ++i) {
+      m_Buffer[m_nIn++ & (ENTROPY_POOL_SIZE - 1)] = static_cast<u8>(value);
+      value >>= 8;
+    }
+  }
+}
+
+// xoshiro256** by David Blackman and Sebastiano Vigna
+u64 CEntropyPool::Next() {
+  const u64 result = Rotl(m_State[1] * 5, 7) * 9;
+  const u64 t = m_State[1] << 17;
+
+  m_State[2] ^= m_State[0];
+  m_State[3] ^= m_State[1];
+  m_State[1] ^= m_State[2];
+  m_State[0] ^= m_State[3];
+
+  m_State[2] ^= t;
+  m_State[3] = Rotl(m_State[3], 45);
+
+  return result;
+}
+
+void CEntropyPool::Mix(const u64 value) {
+  m_State[m_nMixIndex++ & 3] ^= SplitMix64(value);
+  // The all-zero state is a fixed point
+  if ((m_State[0] | m_State[1] | m_State[2] | m_State[3]) == 0) m_State[0] = 1;
+  Next();
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <circle/types.h>
+
+#define ENTROPY_POOL_SIZE        4096          // Must be a power of two
+#define ENTROPY_POOL_STATE_BITS  256
+#define ENTROPY_POOL_SEED_BITS   ENTROPY_POOL_STATE_BITS
+
+/**
+ * Buffered source of random bytes for in-kernel consumers.
+ * The buffer is refilled by the consumer (never from an interrupt, which would disturb the latency
+ * measurements) with the output of a xoshiro256** generator whose state is seeded by (von Neumann
+ * extracted) ReRAM bits. Only seeded bits are credited as entropy; like a DRBG, the generator keeps
+ * delivering once the credited entropy is drawn, so GetEntropyBits() tells how much of it is backed.
+ */
+class CEntropyPool {
+public:
+  CEntropyPool();
+
+  ~CEntropyPool();
+
+  // Fills the buffer
+  void Initialize();
+
+  // Mixes one extracted bit into the generator state and credits it as one bit of entropy;
+  // the bit must not be published anywhere else
+  void AddBit(bool bit);
+
+  // Mixes a word into the generator state without crediting any entropy
+  void AddWord(u32 word);
+
+  // Refills the buffer as needed; returns nCount
+  unsigned GetBytes(void* pBuffer, unsigned nCount);
+
+  // Number of buffered bytes
+  unsigned GetFillLevel() const;
+
+  // Entropy credited to the generator state and not yet drawn
+  unsigned GetEntropyBits() const;
+
+  u64 GetBytesDelivered() const;
+
+  // Tops up the buffer
+  void Refill();
+
+private:
+  u64 Next();
+
+  void Mix(u64 value);
+
+private:
+  u8 m_Buffer[ENTROPY_POOL_SIZE];
+  unsigned m_nIn;
+  unsigned m_nOut;
+
+  u64 m_State[4];
+  unsigned m_nMixIndex;
+  u64 m_nAccumulator;
+  unsigned m_nAccumulated;
+  bool m_bStale; // The buffer holds output of the state before the last reseed
+
+  unsigned m_nEntropyBits;
+  u64 m_nBytesDelivered;
+};
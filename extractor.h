@@ -0,0 +1,77 @@
+#pragma once
+
+#include <circle/types.h>
+
+// Quantises a raw write latency to a single raw bit
+inline bool QuantiseLatency(const u64 latency) {
+  return static_cast<bool>(latency & 1);
+}
+
+// Very basic implementation of von Neumann extractor; returns true if the pair yields a bit
+inline bool VonNeumann(const bool bit1, const bool bit2, bool& bit) {
+  if (bit1 == bit2) return false;
+  bit = bit1;
+  return true;
+}
+
+#define LATENCY_BASELINE_SHIFT  8  // Fixed point fraction bits of the baseline
+#define LATENCY_BASELINE_RATE   16 // Step per sample in 1/256 latency units
+
+/**
+ * Drift tracking median of the write latencies (stochastic approximation: the estimate moves a fixed step
+ * towards every sample). Quantising against it keeps the raw bits balanced when the latency distribution
+ * shifts, e.g. with temperature.
+ */
+class CLatencyBaseline {
+public:
+  explicit CLatencyBaseline(const u64 nRate = LATENCY_BASELINE_RATE) : m_nRate(nRate) {
+    Reset();
+  }
+
+  void Reset() {
+    m_nBaseline = 0;
+    m_bInitialised = false;
+  }
+
+  // Above the baseline is 1, below is 0, ties fall back to the LSB; then tracks the sample
+  bool Quantise(const u64 latency) {
+    const u64 scaled = latency << LATENCY_BASELINE_SHIFT;
+    if (!m_bInitialised) {
+      m_nBaseline = scaled;
+      m_bInitialised = true;
+    }
+
+    bool bit;
+    if (scaled > m_nBaseline) {
+      bit = true;
+      m_nBaseline += m_nRate;
+    } else if (scaled < m_nBaseline) {
+      bit = false;
+      m_nBaseline -= m_nRate < m_nBaseline ? m_nRate : m_nBaseline;
+    } else {
+      bit = QuantiseLatency(latency);
+    }
+    return bit;
+  }
+
+  // Rounded to whole latency units
+  u64 GetBaseline() const {
+    return (m_nBaseline + (1 << (LATENCY_BASELINE_SHIFT - 1))) >> LATENCY_BASELINE_SHIFT;
+  }
+
+private:
+  u64 m_nRate;
+  u64 m_nBaseline;
+  bool m_bInitialised;
+};
+
+// One step of ExtractSingleBit: quantises both latencies (median or LSB quantiser, the baseline tracks both
+// either way) and feeds the bits to the von Neumann extractor; returns true if the pair yields a bit
+inline bool ExtractLatencyPair(CLatencyBaseline& baseline, const bool median, const u64 latency1,
+                               const u64 latency2, bool& bit) {
+  const bool median1 = baseline.Quantise(latency1);
+  const bool median2 = baseline.Quantise(latency2);
+  const bool bit1 = median ? median1 : QuantiseLatency(latency1);
+  const bool bit2 = median ? median2 : QuantiseLatency(latency2);
+  return VonNeumann(bit1, bit2, bit);
+}
@@ -0,0 +1,64 @@
+//
+// health_tests.cpp
+//
+#include "health_tests.h"
+
+CHealthTests::CHealthTests(const unsigned nRCTCutoff, const unsigned nAPTCutoff, const unsigned nAPTWindow)
+  : m_nRCTCutoff(nRCTCutoff),
+    m_nAPTCutoff(nAPTCutoff),
+    m_nAPTWindow(nAPTWindow) {
+  Reset();
+}
+
+void CHealthTests::Reset() {
+  m_nSamples = 0;
+  m_nRCTSample = 0;
+  m_nRCTCount = 0;
+  m_nRCTFailures = 0;
+  m_nAPTSample = 0;
+  m_nAPTIndex = 0;
+  m_nAPTCount = 0;
+  m_nAPTFailures = 0;
+}
+
+bool CHealthTests::Feed(const u64 sample) {
+  bool passed = true;
+
+  // Repetition count test
+  if (m_nSamples > 0 && sample == m_nRCTSample) {
+    if (++m_nRCTCount == m_nRCTCutoff) {
+      ++m_nRCTFailures;
+      passed = false;
+    }
+  } else {
+    m_nRCTSample = sample;
+    m_nRCTCount = 1;
+  }
+
+  // Adaptive proportion test
+  if (m_nAPTIndex == 0) {
+    m_nAPTSample = sample;
+    m_nAPTCount = 1;
+  } else if (sample == m_nAPTSample) {
+    if (++m_nAPTCount == m_nAPTCutoff) {
+      ++m_nAPTFailures;
+      passed = false;
+    }
+  }
+  if (++m_nAPTIndex == m_nAPTWindow) m_nAPTIndex = 0;
+
+  ++m_nSamples;
+  return passed;
+}
+
+u64 CHealthTests::GetSamples() const {
+  return m_nSamples;
+}
+
+unsigned CHealthTests::GetRepetitionFailures() const {
+  return m_nRCTFailures;
+}
+
+unsigned CHealthTests::GetProportionFailures() const {
+  return m_nAPTFailures;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <circle/types.h>
+
+// Cutoffs of the SP 800-90B (4.4) health tests for an assessed min-entropy of
+// 1 bit per raw latency and a false positive probability of 2^-20
+#define HEALTH_RCT_CUTOFF      21
+#define HEALTH_APT_WINDOW      512
+#define HEALTH_APT_CUTOFF      410
+
+/**
+ * Repetition count and adaptive proportion tests on raw write latencies.
+ * Failures are only counted; it is up to the caller to act on them.
+ */
+class CHealthTests {
+public:
+  explicit CHealthTests(unsigned nRCTCutoff = HEALTH_RCT_CUTOFF, unsigned nAPTCutoff = HEALTH_APT_CUTOFF,
+                        unsigned nAPTWindow = HEALTH_APT_WINDOW);
+
+  void Reset();
+
+  // Returns false if this sample made one of the tests fail
+  bool Feed(u64 sample);
+
+  u64 GetSamples() const;
+
+  unsigned GetRepetitionFailures() const;
+
+  unsigned GetProportionFailures() const;
+
+private:
+  unsigned m_nRCTCutoff;
+  unsigned m_nAPTCutoff;
+  unsigned m_nAPTWindow;
+
+  u64 m_nSamples;
+
+  u64 m_nRCTSample;
+  unsigned m_nRCTCount;
+  unsigned m_nRCTFailures;
+
+  u64 m_nAPTSample;
+  unsigned m_nAPTIndex;
+  unsigned m_nAPTCount;
+  unsigned m_nAPTFailures;
+};
@@ -1,12 +1,14 @@
 #!/bin/bash
 
 pushd circle
-echo -e "PREFIX64 = aarch64-linux-gnu-\nAARCH = 64\nRASPPI = 3\n" > Config.mk
+echo -e "PREFIX64 = aarch64-linux-gnu-\nAARCH = 64\nRASPPI = 3\nDEFINE += -DARM_ALLOW_MULTI_CORE\n" > Config.mk
 ./makeall --nosample -j4
 pushd boot
 make
 popd
 pushd addon/fatfs
+# f_expand, so output files are preallocated contiguously (output_file.cpp)
+sed -i 's/^#define FF_USE_EXPAND\s\+0/#define FF_USE_EXPAND\t1/' ffconf.h
 make -j4
 popd
 pushd addon/Properties
@@ -4,7 +4,12 @@
 #include "kernel.h"
 
 #include "mt19937ar.h"
+#include "output_file.h"
+#include "trace_format.h"
 #include <Properties/propertiesfatfsfile.h>
+#include <circle/bcmpropertytags.h>
+#include <circle/synchronize.h>
+#include <circle/util.h>
 
 #define DRIVE        "SD:"
 #define PARAMFILE    "/params.properties"
@@ -12,10 +17,39 @@
 CKernel::CKernel()
   : m_Timer(&m_Interrupt),
     m_Logger(LogDebug, &m_Timer),
+#if SPI_ASYNC
+    m_SPIQueue(&m_Interrupt, SPI_FREQ, SPI_CPOL, SPI_CPHA, SPI_CHIP_SELECT),
+#else
     m_SPIMaster(SPI_FREQ, SPI_CPOL, SPI_CPHA, SPI_MASTER_DEVICE),
+    m_nSPIClock(SPI_FREQ),
+#endif
+    m_SPIClocks{MEM_SPI_FREQ_WREN, MEM_SPI_FREQ_WRITE, MEM_SPI_FREQ_POLL, MEM_SPI_FREQ_READ},
+#if SAMPLER_CORE
+    m_SamplerCore(this),
+#endif
+    m_EntropyPool(),
+    m_bMedianQuantiser(false),
+    m_WearTracker(MEM_SIZE_ADR),
+    m_bWearLeveling(true),
+    m_nChainLength(CHAIN_LENGTH_DEFAULT),
+    m_nChainAddr(0),
+    m_nChainRemaining(0),
+    m_pFastStartBits(nullptr),
+    m_nFastStartBits(0),
+    m_nFastStartRaw(0),
+    m_bFastStartFailed(false),
+    m_nFastStartTaken(0),
+    m_pLatencyRing(nullptr),
+    m_nStallThreshold(0),
     m_WEPin(25, GPIOModeOutput),
     m_EMMC(&m_Interrupt, &m_Timer, &m_ActLED),
-    m_FileSystem() {}
+    m_FileSystem(),
+    m_pProperties(nullptr),
+    m_pJobName(nullptr)
+#if SPI_ASYNC
+    , m_bPairPending(false)
+#endif
+{}
 
 CKernel::~CKernel() = default;
 
@@ -41,24 +75,62 @@ bool CKernel::Initialize() {
   }
 
   if (bOK) {
+    bOK = m_Arena.Initialize();
+    if (bOK) {
+      m_Logger.Write(FromKernel, LogNotice, "Measurement arena: %u KB",
+                     static_cast<unsigned>(m_Arena.GetSize() / 1024));
+    }
+  }
+
+  if (bOK) {
+    // Not credited; the pool is seeded from the ReRAM in Run()
+    for (int i = 0; i < 4; ++i) {
+      m_EntropyPool.AddWord(m_Random.GetNumber());
+    }
+    m_EntropyPool.Initialize();
+  }
+
+  if (bOK) {
+#if SPI_ASYNC
+    bOK = m_SPIQueue.Initialize();
+#else
     bOK = m_SPIMaster.Initialize();
+#endif
   }
 
+#if SAMPLER_CORE
   if (bOK) {
-    bOK = m_EMMC.Initialize();
+    bOK = m_SamplerCore.Initialize();
   }
+#endif
 
+  // The SD card is initialised in Run(), while sampling has already started
   return bOK;
 }
 
 TShutdownMode CKernel::Run() {
   m_Logger.Write(FromKernel, LogNotice, "Compile time: " __DATE__ " " __TIME__);
   m_Logger.Write(FromKernel, LogNotice, "Memory: %s, SPI Frequency: %lld Hz", MEM_NAME, SPI_FREQ);
+  if (SPI_FREQ > MEM_SPI_FREQ_MAX) {
+    m_Logger.Write(FromKernel, LogWarning, "SPI Frequency exceeds the maximum of %u Hz for this memory",
+                   MEM_SPI_FREQ_MAX);
+  }
+#if SPI_ASYNC
+  m_Logger.Write(FromKernel, LogNotice, "SPI access: asynchronous (DMA)");
+#endif
 
+  MeasurementResult result;
+#if SAMPLER_CORE
+  // Sample into RAM on the sampler core while the SD card comes up
+  const u64 fastStart = CTimer::GetClockTicks64();
+  m_pFastStartBits = new u8[FAST_START_MAX_BITS / 8];
+  memset(m_pFastStartBits, 0, FAST_START_MAX_BITS / 8);
+  m_SamplerCore.Start(SamplerTaskFastStart);
+#else
   // Do dummy measurement
   int raw = 0;
   bool bit;
-  MeasurementResult result = ExtractSingleBit(bit, raw, 1000, 1000);
+  result = ExtractSingleBit(bit, raw, 1000, 1000);
   if (result != Okay) {
     m_Logger.Write(FromKernel, LogNotice, "Failed to generate single bit... Shutting down...");
     IndicateStop(result);
@@ -69,6 +141,24 @@ TShutdownMode CKernel::Run() {
   m_Logger.Write(FromKernel, LogNotice, "Successfully generated bit %d with %d raw bits!", bit, raw);
   m_ActLED.Blink(5, 100, 100);
 
+  // Seed entropy pool from the ReRAM
+  result = SeedEntropyPool(ENTROPY_POOL_SEED_BITS, 1000);
+  if (result != Okay) {
+    m_Logger.Write(FromKernel, LogNotice, "Failed to seed entropy pool... Shutting down...");
+    IndicateStop(result);
+    return ShutdownNone;
+  }
+  m_Logger.Write(FromKernel, LogNotice, "Entropy pool seeded: %u bits, %u bytes buffered",
+                 m_EntropyPool.GetEntropyBits(), m_EntropyPool.GetFillLevel());
+
+#endif
+
+  if (!m_EMMC.Initialize()) {
+    m_Logger.Write(FromKernel, LogPanic, "Cannot initialize SD card");
+    IndicateStop(FailedTotally);
+    return ShutdownNone;
+  }
+
   // Mount file system
   if (f_mount(&m_FileSystem, DRIVE, 1) != FR_OK) {
     m_Logger.Write(FromKernel, LogPanic, "Cannot mount drive: %s", DRIVE);
@@ -84,25 +174,228 @@ TShutdownMode CKernel::Run() {
     IndicateStop(FailedTotally);
     return ShutdownNone;
   }
+  m_pProperties = &Properties;
 
-  // Read selected mode
-  const char* cMode = Properties.GetString("mode", "trng");
+#if SAMPLER_CORE
+  // Storage is ready; take over the SPI memory again
+  m_SamplerCore.Stop();
+  m_Logger.Write(FromKernel, LogNotice, "Sampled %u bits with %d raw bits during start-up (%llu µs)",
+                 m_nFastStartBits, m_nFastStartRaw, CTimer::GetClockTicks64() - fastStart);
+  m_Logger.Write(FromKernel, LogNotice, "Health test failures during start-up: RCT %u, APT %u",
+                 m_HealthTests.GetRepetitionFailures(), m_HealthTests.GetProportionFailures());
+  if (m_bFastStartFailed && m_nFastStartBits == 0) {
+    m_Logger.Write(FromKernel, LogNotice, "Failed to generate single bit... Shutting down...");
+    IndicateStop(FailedTotally);
+    return ShutdownNone;
+  }
+  m_ActLED.Blink(5, 100, 100);
+
+  // The first buffered bits seed the entropy pool, the rest is TRNG output
+  int seedRaw = 0;
+  bool seedBit;
+  int seeded = 0;
+  for (; seeded < ENTROPY_POOL_SEED_BITS && TakeFastStartBit(seedBit, seedRaw); ++seeded) {
+    m_EntropyPool.AddBit(seedBit);
+  }
+  result = SeedEntropyPool(ENTROPY_POOL_SEED_BITS - seeded, 1000);
+  if (result != Okay) {
+    m_Logger.Write(FromKernel, LogNotice, "Failed to seed entropy pool... Shutting down...");
+    IndicateStop(result);
+    return ShutdownNone;
+  }
+  m_Logger.Write(FromKernel, LogNotice, "Entropy pool seeded: %u bits, %u bytes buffered",
+                 m_EntropyPool.GetEntropyBits(), m_EntropyPool.GetFillLevel());
+#endif
+
+  // Load wear counters; writes done so far are added to them
+  CString wearFile;
+  wearFile.Format(DRIVE "%s", GetParamString("wear_file", MEM_NAME_SIMPLE "_wear.bin"));
+  const char* cWearFile = wearFile;
+  FRESULT wearResult = m_WearTracker.Load(cWearFile);
+  if (wearResult != FR_OK) {
+    m_Logger.Write(FromKernel, LogWarning, "Cannot load wear counters from %s (%d)", cWearFile, wearResult);
+  }
+  m_Logger.Write(FromKernel, LogNotice, "%llu writes tracked, most worn cell: %llu writes",
+                 m_WearTracker.GetTotalWrites(), m_WearTracker.GetMaxWrites());
+
+  // Run the job list or, if there is none, the selected mode
+  char jobList[JOBS_LIST_MAX];
+  const char* jobs[JOBS_MAX];
+  const unsigned jobCount = ParseJobList(Properties.GetString("jobs", ""), jobList, jobs);
+  if (jobCount == 0) {
+    result = RunJob(nullptr);
+  } else {
+    m_Logger.Write(FromKernel, LogNotice, "Running %u jobs", jobCount);
+    MeasurementResult jobResults[JOBS_MAX];
+    u64 jobDurations[JOBS_MAX];
+    unsigned succeeded = 0, failed = 0;
+    for (unsigned i = 0; i < jobCount; ++i) {
+      m_Logger.Write(FromKernel, LogNotice, "Job %u/%u: %s", i + 1, jobCount, jobs[i]);
+      const u64 start = CTimer::GetClockTicks64();
+      jobResults[i] = RunJob(jobs[i]);
+      jobDurations[i] = CTimer::GetClockTicks64() - start;
+      m_Logger.Write(FromKernel, LogNotice, "Job %s finished: %s after %llu ms", jobs[i],
+                     GetResultName(jobResults[i]), jobDurations[i] / 1000);
+      if (jobResults[i] == Okay) ++succeeded;
+      if (jobResults[i] == FailedTotally) ++failed;
+      // Keep the wear of finished jobs even if a later one never returns
+      m_WearTracker.Save(cWearFile);
+    }
+    WriteJobSummary(jobs, jobResults, jobDurations, jobCount);
+
+    result = succeeded == jobCount ? Okay : failed == jobCount ? FailedTotally : FailedPartially;
+  }
+
+  // Shutdown
+  wearResult = m_WearTracker.Save(cWearFile);
+  if (wearResult != FR_OK) {
+    m_Logger.Write(FromKernel, LogError, "Cannot save wear counters to %s (%d)", cWearFile, wearResult);
+  }
+  m_Logger.Write(FromKernel, LogNotice, "%llu writes tracked, most worn cell: %llu writes",
+                 m_WearTracker.GetTotalWrites(), m_WearTracker.GetMaxWrites());
+  m_pProperties = nullptr;
+  IndicateStop(result);
+  return ShutdownNone;
+}
+
+MeasurementResult CKernel::RunJob(const char* name) {
+  m_pJobName = name;
+#if SPI_ASYNC
+  DiscardPendingPair();
+#endif
+  // Buffers of the previous job are gone, however it returned
+  m_Arena.Reset(static_cast<size_t>(GetParamNumber("arena_budget", 0)) * 1024);
+  LoadClockProfile();
+  m_bWearLeveling = GetParamNumber("wear_leveling", 1) != 0;
+  m_Logger.Write(FromKernel, LogNotice, "Wear leveling: %s", m_bWearLeveling ? "on" : "off");
+  const CString quantiser(GetParamString("quantiser", "lsb"));
+  m_bMedianQuantiser = quantiser.Compare("median") == 0;
+  // The baseline depends on the clock profile
+  m_Baseline.Reset();
+  m_Logger.Write(FromKernel, LogNotice, "Quantiser: %s", m_bMedianQuantiser ? "median" : "lsb");
+  m_nChainLength = GetParamNumber("chain_length", CHAIN_LENGTH_DEFAULT);
+  if (m_nChainLength < 2) m_nChainLength = 2;
+  m_nChainRemaining = 0;
+  if (m_nFastStartBits > m_nFastStartTaken && !HasFastStartSettings()) {
+    m_Logger.Write(FromKernel, LogNotice, "Discarding %u bits sampled during start-up with other settings",
+                   m_nFastStartBits - m_nFastStartTaken);
+    ReleaseFastStartBits();
+  }
+
+  // A job without its own mode runs the mode it is named after; the global mode only applies without a job list
+  const char* cMode = "trng";
+  if (name == nullptr) {
+    cMode = GetParamString("mode", cMode);
+  } else {
+    cMode = name;
+    CString jobKey;
+    jobKey.Format("%s_mode", name);
+    if (m_pProperties != nullptr && m_pProperties->IsSet(jobKey)) cMode = m_pProperties->GetString(jobKey, name);
+  }
   const CString mode(cMode);
   m_Logger.Write(FromKernel, LogNotice, "Selected mode: %s", cMode);
 
   // Run selected mode
+  MeasurementResult result;
   if (mode.Compare("demo") == 0)
     result = DemoMode();
   else if (mode.Compare("raw") == 0)
     result = WriteLatencyRngTest2();
   else if (mode.Compare("burnout") == 0)
     result = BurnOutCells();
+  else if (mode.Compare("trace") == 0)
+    result = WriteLatencyTrace();
+  else if (mode.Compare("page") == 0)
+    result = PageWriteStudy();
+  else if (mode.Compare("bench") == 0)
+    result = BenchMode();
+  else if (mode.Compare("realtime") == 0)
+    result = RealtimeMode();
+  else if (mode.Compare("sp80090b") == 0)
+    result = SP80090BMode();
   else
     result = WriteLatencyRngTest();
+  // The bits sampled during start-up only lead the output of the first job (if it is trng)
+  ReleaseFastStartBits();
 
-  // Shutdown
-  IndicateStop(result);
-  return ShutdownNone;
+  m_Logger.Write(FromKernel, LogNotice, "Arena: %u KB used, high-water mark %u KB of %u KB",
+                 static_cast<unsigned>(m_Arena.GetUsed() / 1024), static_cast<unsigned>(m_Arena.GetHighWater() / 1024),
+                 static_cast<unsigned>(m_Arena.GetSize() / 1024));
+
+  m_pJobName = nullptr;
+  return result;
+}
+
+MeasurementResult CKernel::ArenaExhausted(const char* pBuffer, const size_t nBytes) {
+  m_Logger.Write(FromKernel, LogError, "Not enough memory for %s: needs %u KB, %u KB left (arena_budget, %u KB arena)",
+                 pBuffer, static_cast<unsigned>(nBytes / 1024), static_cast<unsigned>(m_Arena.GetAvailable() / 1024),
+                 static_cast<unsigned>(m_Arena.GetSize() / 1024));
+  return FailedTotally;
+}
+
+unsigned CKernel::ParseJobList(const char* list, char* buffer, const char** jobs) {
+  unsigned length = strlen(list);
+  if (length >= JOBS_LIST_MAX) length = JOBS_LIST_MAX - 1;
+  memcpy(buffer, list, length);
+  buffer[length] = '\0';
+
+  unsigned count = 0;
+  for (char* pos = buffer; *pos != '\0' && count < JOBS_MAX;) {
+    while (*pos == ',' || *pos == ' ') *pos++ = '\0';
+    if (*pos == '\0') break;
+    jobs[count++] = pos;
+    while (*pos != '\0' && *pos != ',' && *pos != ' ') ++pos;
+  }
+  return count;
+}
+
+unsigned CKernel::ParseNumberList(const char* list, unsigned* numbers, const unsigned maxNumbers) {
+  unsigned count = 0;
+  while (*list != '\0' && count < maxNumbers) {
+    unsigned number = 0;
+    bool digits = false;
+    for (; *list >= '0' && *list <= '9'; ++list) {
+      number = number * 10 + (*list - '0');
+      digits = true;
+    }
+    if (digits) numbers[count++] = number;
+    if (*list != '\0') ++list;
+  }
+  return count;
+}
+
+void CKernel::WriteJobSummary(const char** jobs, const MeasurementResult* results, const u64* durations,
+                              const unsigned count) {
+#define FILENAME_JOBS MEM_NAME_SIMPLE "_%d_jobs.csv"
+  const CString fileName = GetFreeFile(DRIVE FILENAME_JOBS);
+  const char* cFileName = fileName;
+
+  COutputFile file;
+  FRESULT Result = file.Open(fileName);
+  file.Write("job,name,result,duration_ms\n");
+  CString Msg;
+  for (unsigned i = 0; i < count; ++i) {
+    Msg.Format("%u,%s,%s,%llu\n", i + 1, jobs[i], GetResultName(results[i]), durations[i] / 1000);
+    file.Write(Msg);
+  }
+  if (Result == FR_OK) Result = file.Close();
+  if (Result == FR_OK) {
+    m_Logger.Write(FromKernel, LogNotice, "Successfully written job summary to %s!", cFileName);
+  } else {
+    m_Logger.Write(FromKernel, LogError, "Cannot write job summary %s (%d)", cFileName, Result);
+  }
+}
+
+const char* CKernel::GetResultName(const MeasurementResult result) {
+  switch (result) {
+  case Okay:
+    return "okay";
+  case FailedPartially:
+    return "failed_partially";
+  case FailedTotally:
+    return "failed_totally";
+  }
+  return "unknown";
 }
 
 bool CKernel::FileExists(const char* path) {
@@ -111,13 +404,117 @@ bool CKernel::FileExists(const char* path) {
 
 CString CKernel::GetFreeFile(const char* pattern) {
   CString Msg;
+  Msg.Format(pattern, GetFreeIndex(&pattern, 1));
+  return Msg;
+}
+
+int CKernel::GetFreeIndex(const char* const* patterns, const unsigned count) {
+  CString Msg;
+
+  // Scan the directory once per pattern instead of probing every index with f_stat
+  constexpr int maxScanned = 4096;
+  u32 used[maxScanned / 32] = {};
+  bool scanned = true;
+  for (unsigned p = 0; p < count; ++p) {
+    const char* pattern = patterns[p];
+    char dir[64];
+    unsigned dirLen = 0;
+    bool indexed = false;
+    for (unsigned i = 0; pattern[i] != '\0' && i < sizeof(dir) - 1; ++i) {
+      dir[i] = pattern[i];
+      if (pattern[i] == ':' || pattern[i] == '/') dirLen = i + 1;
+      if (pattern[i] == '%' && pattern[i + 1] == 'd') indexed = true;
+    }
+    dir[dirLen] = '\0';
+    const char* prefix = indexed ? pattern + dirLen : nullptr;
+
+    DIR directory;
+    if (prefix == nullptr || f_opendir(&directory, dir) != FR_OK) {
+      scanned = false;
+      break;
+    }
+    const char* suffix = prefix;
+    while (suffix[0] != '%' || suffix[1] != 'd') ++suffix;
+    const unsigned prefixLen = suffix - prefix;
+    suffix += 2;
+    const unsigned suffixLen = strlen(suffix);
+
+    FILINFO info;
+    while (f_readdir(&directory, &info) == FR_OK && info.fname[0] != '\0') {
+      const unsigned len = strlen(info.fname);
+      // FAT names are case-insensitive (and upper case without long file names)
+      if (len <= prefixLen + suffixLen
+          || strncasecmp(info.fname, prefix, prefixLen) != 0
+          || strcasecmp(info.fname + len - suffixLen, suffix) != 0) continue;
+      int idx = 0;
+      unsigned i = prefixLen;
+      for (; i < len - suffixLen && info.fname[i] >= '0' && info.fname[i] <= '9' && idx < maxScanned; ++i) {
+        idx = idx * 10 + (info.fname[i] - '0');
+      }
+      if (i == len - suffixLen && idx < maxScanned) used[idx / 32] |= 1u << (idx % 32);
+    }
+    f_closedir(&directory);
+  }
+
+  // Always starts at index 0: after a scan, the indices below maxScanned marked as used are skipped without
+  // f_stat; without one (no %d or no directory), every index is probed. The scan only finds names spelled
+  // like the pattern, so an index is confirmed before it is used.
   for (int i = 0; ; ++i) {
-    Msg.Format(pattern, i);
-    if (!FileExists(Msg)) return Msg;
+    if (scanned && i < maxScanned && used[i / 32] & 1u << (i % 32)) continue;
+    bool free = true;
+    for (unsigned p = 0; p < count && free; ++p) {
+      Msg.Format(patterns[p], i);
+      free = !FileExists(Msg);
+    }
+    if (free) return i;
+  }
+}
+
+unsigned CKernel::GetParamNumber(const char* name, const unsigned defaultValue) const {
+  if (m_pProperties == nullptr) return defaultValue;
+  if (m_pJobName != nullptr) {
+    CString jobKey;
+    jobKey.Format("%s_%s", m_pJobName, name);
+    if (m_pProperties->IsSet(jobKey)) return m_pProperties->GetNumber(jobKey, defaultValue);
+  }
+  return m_pProperties->GetNumber(name, defaultValue);
+}
+
+const char* CKernel::GetParamString(const char* name, const char* defaultValue) const {
+  if (m_pProperties == nullptr) return defaultValue;
+  if (m_pJobName != nullptr) {
+    CString jobKey;
+    jobKey.Format("%s_%s", m_pJobName, name);
+    if (m_pProperties->IsSet(jobKey)) return m_pProperties->GetString(jobKey, defaultValue);
+  }
+  return m_pProperties->GetString(name, defaultValue);
+}
+
+void CKernel::LoadClockProfile() {
+  m_SPIClocks = {MEM_SPI_FREQ_WREN, MEM_SPI_FREQ_WRITE, MEM_SPI_FREQ_POLL, MEM_SPI_FREQ_READ};
+  const unsigned common = GetParamNumber("spi_freq", 0);
+  if (common != 0) {
+    m_SPIClocks = {common, common, common, common};
+  }
+  m_SPIClocks.WriteEnable = GetParamNumber("spi_freq_wren", m_SPIClocks.WriteEnable);
+  m_SPIClocks.Write = GetParamNumber("spi_freq_write", m_SPIClocks.Write);
+  m_SPIClocks.Poll = GetParamNumber("spi_freq_poll", m_SPIClocks.Poll);
+  m_SPIClocks.Read = GetParamNumber("spi_freq_read", m_SPIClocks.Read);
+
+  m_Logger.Write(FromKernel, LogNotice, "SPI clocks: WREN %u Hz, WR %u Hz, RDSR %u Hz, READ %u Hz",
+                 m_SPIClocks.WriteEnable, m_SPIClocks.Write, m_SPIClocks.Poll, m_SPIClocks.Read);
+  if (m_SPIClocks.WriteEnable > MEM_SPI_FREQ_MAX || m_SPIClocks.Write > MEM_SPI_FREQ_MAX
+      || m_SPIClocks.Poll > MEM_SPI_FREQ_MAX || m_SPIClocks.Read > MEM_SPI_FREQ_MAX) {
+    m_Logger.Write(FromKernel, LogWarning, "SPI clock exceeds the maximum of %u Hz for this memory",
+                   MEM_SPI_FREQ_MAX);
   }
 }
 
 void CKernel::IndicateStop(const MeasurementResult result) {
+#if SAMPLER_CORE
+  // Leave the memory alone from now on
+  m_SamplerCore.Stop();
+#endif
   switch (result) {
   case Okay:
     m_ActLED.Blink(1000000000); // Will pretty much never stop
@@ -131,10 +528,101 @@ void CKernel::IndicateStop(const MeasurementResult result) {
   }
 }
 
+MeasurementResult CKernel::SeedEntropyPool(const int bits, const int timeout) {
+  int raw = 0;
+  bool bit;
+  for (int i = 0; i < bits; ++i) {
+    const MeasurementResult result = ExtractSingleBit(bit, raw, 1000, timeout);
+    if (result != Okay) return result;
+    m_EntropyPool.AddBit(bit);
+  }
+  return Okay;
+}
+
+void CKernel::FastStartSampling() {
+  int raw = 0;
+  bool bit;
+  unsigned count = 0;
+#if SAMPLER_CORE
+  while (!m_SamplerCore.IsStopRequested() && count < FAST_START_MAX_BITS) {
+#else
+  while (count < FAST_START_MAX_BITS) {
+#endif
+    if (ExtractSingleBit(bit, raw, 1000, 1000) != Okay) {
+      m_bFastStartFailed = true;
+      break;
+    }
+    if (bit) m_pFastStartBits[count / 8] |= 1 << (count % 8);
+    m_nFastStartRaw = raw;
+    ++count;
+    DataMemBarrier();
+    m_nFastStartBits = count;
+  }
+}
+
+bool CKernel::TakeFastStartBit(bool& bit, int& totalGenerated) {
+  if (m_nFastStartTaken >= m_nFastStartBits) {
+    ReleaseFastStartBits();
+    return false;
+  }
+
+  // All raw bits are accounted to the first buffered bit
+  if (m_nFastStartTaken == 0) totalGenerated += m_nFastStartRaw;
+  bit = m_pFastStartBits[m_nFastStartTaken / 8] >> (m_nFastStartTaken % 8) & 1;
+  ++m_nFastStartTaken;
+  return true;
+}
+
+bool CKernel::HasFastStartSettings() const {
+  return m_nChainLength == CHAIN_LENGTH_DEFAULT && !m_bMedianQuantiser && m_bWearLeveling
+         && m_SPIClocks.WriteEnable == MEM_SPI_FREQ_WREN && m_SPIClocks.Write == MEM_SPI_FREQ_WRITE
+         && m_SPIClocks.Poll == MEM_SPI_FREQ_POLL && m_SPIClocks.Read == MEM_SPI_FREQ_READ;
+}
+
+void CKernel::ReleaseFastStartBits() {
+  if (m_pFastStartBits == nullptr) return;
+  delete[] m_pFastStartBits;
+  m_pFastStartBits = nullptr;
+  m_nFastStartBits = 0;
+  m_nFastStartTaken = 0;
+}
+
+unsigned CKernel::GetTemperature() {
+  CBcmPropertyTags Tags;
+  TPropertyTagTemperature TagTemperature;
+  TagTemperature.nTemperatureId = TEMPERATURE_ID;
+  if (!Tags.GetTag(PROPTAG_GET_TEMPERATURE, &TagTemperature, sizeof(TagTemperature), 4)) return 0;
+  return TagTemperature.nValue;
+}
+
+u64 CKernel::GetBoardSerial() {
+  CBcmPropertyTags Tags;
+  TPropertyTagSerial TagSerial;
+  if (!Tags.GetTag(PROPTAG_GET_BOARD_SERIAL, &TagSerial, sizeof(TagSerial))) return 0;
+  return static_cast<u64>(TagSerial.Serial[1]) << 32 | TagSerial.Serial[0];
+}
+
+bool CKernel::Quantise(const u64 latency) {
+  const bool median = m_Baseline.Quantise(latency);
+  return m_bMedianQuantiser ? median : QuantiseLatency(latency);
+}
+
+u8 CKernel::GetRandomByte() {
+  u8 value;
+  m_EntropyPool.GetBytes(&value, 1);
+  return value;
+}
+
 MeasurementResult CKernel::RandomWriteLatency(u64& write_latency, const int addr, const int num1, const int num2,
                                               const int timeout) {
+  u64 first_latency;
+  return RandomWriteLatency(first_latency, write_latency, addr, num1, num2, timeout);
+}
+
+MeasurementResult CKernel::RandomWriteLatency(u64& first_latency, u64& write_latency, const int addr, const int num1,
+                                              const int num2, const int timeout) {
   // Write first value
-  const MeasurementResult result = MemWriteAndPoll(write_latency, addr, num1, timeout);
+  const MeasurementResult result = MemWriteAndPoll(first_latency, addr, num1, timeout);
   if (result != Okay) return result;
 
   // Overwrite value; write_latency should be rather random now
@@ -150,35 +638,92 @@ MeasurementResult CKernel::RandomWriteLatency(u64& write_latency, const int time
   const int num2 = static_cast<int>(m_Random.GetNumber() % 256);*/
 
   // Use MT19937AR as "seed"
-  const int addr = static_cast<int>(genrand_range(0, MEM_SIZE_ADR));
+  const int addr = static_cast<int>(SelectRandomAddress());
   const int num1 = static_cast<int>(genrand_range(0, 256));
   const int num2 = static_cast<int>(genrand_range(0, 256));
 
   return RandomWriteLatency(write_latency, addr, num1, num2, timeout);
 }
 
+MeasurementResult CKernel::ChainedWriteLatency(u64& write_latency, const int timeout) {
+  MeasurementResult result;
+  if (m_nChainRemaining == 0) {
+    // The cell's old value is unknown; this write only sets a random predecessor
+    m_nChainAddr = SelectRandomAddress();
+    u64 temp;
+    result = MemWriteAndPoll(temp, m_nChainAddr, genrand_range(0, 256), timeout);
+    if (result != Okay) return result;
+    m_nChainRemaining = m_nChainLength - 1;
+  }
+
+  --m_nChainRemaining;
+  result = MemWriteAndPoll(write_latency, m_nChainAddr, genrand_range(0, 256), timeout);
+  if (result != Okay) m_nChainRemaining = 0;
+  return result;
+}
+
+u32 CKernel::SelectRandomAddress() {
+  const u32 addr = genrand_range(0, MEM_SIZE_ADR);
+  if (!m_bWearLeveling) return addr;
+  return m_WearTracker.SelectAddress(addr, genrand_range(0, MEM_SIZE_ADR));
+}
+
 MeasurementResult CKernel::WriteLatencyRandomBit(bool& bit, const int timeout) {
   // Extract "random" LSB
   u64 write_latency;
-  const MeasurementResult result = RandomWriteLatency(write_latency, timeout);
-  bit = static_cast<bool>(write_latency & 1);
+  const MeasurementResult result = ChainedWriteLatency(write_latency, timeout);
+  if (result != Okay) return result;
+  m_HealthTests.Feed(write_latency);
+  bit = Quantise(write_latency);
   return result;
 }
 
+#if SPI_ASYNC
+void CKernel::DiscardPendingPair() {
+  if (!m_bPairPending) return;
+  // Its latencies belong to the previous access pattern (or clock profile), so they are not used
+  u64 latency;
+  WaitLatencySample(latency, m_PendingPair[0]);
+  WaitLatencySample(latency, m_PendingPair[1]);
+  m_bPairPending = false;
+}
+#endif
+
 MeasurementResult CKernel::ExtractSingleBit(bool& bit, int& totalGenerated, int tries, const int timeout) {
-  bool bit1, bit2;
+#if SPI_ASYNC
+  // Keeps the next pair of measurements on the bus while the current one is evaluated
+  // and while the caller processes the returned bit, unless the caller accesses the memory in between
+  u64 latency1, latency2;
   while (tries < 0 || tries-- > 0) {
-    // Very basic implementation of von Neumann extractor
-    MeasurementResult result = WriteLatencyRandomBit(bit1, timeout);
-    if (result != Okay) continue;
-    result = WriteLatencyRandomBit(bit2, timeout);
-    if (result != Okay) continue;
-    totalGenerated += 2;
-    if (bit1 != bit2) {
-      bit = bit1;
-      return Okay;
+    if (!m_bPairPending) {
+      StartChainedWriteLatency(m_PendingPair[0], timeout);
+      StartChainedWriteLatency(m_PendingPair[1], timeout);
     }
+    const MeasurementResult result1 = WaitLatencySample(latency1, m_PendingPair[0]);
+    const MeasurementResult result2 = WaitLatencySample(latency2, m_PendingPair[1]);
+    // Like ChainedWriteLatency, a failed measurement ends its chain
+    if (result1 != Okay || result2 != Okay) m_nChainRemaining = 0;
+    StartChainedWriteLatency(m_PendingPair[0], timeout);
+    StartChainedWriteLatency(m_PendingPair[1], timeout);
+    m_bPairPending = true;
+
+    if (result1 != Okay || result2 != Okay) continue;
+    m_HealthTests.Feed(latency1);
+    m_HealthTests.Feed(latency2);
+    totalGenerated += 2;
+    if (ExtractLatencyPair(m_Baseline, m_bMedianQuantiser, latency1, latency2, bit)) return Okay;
   }
+#else
+  u64 latency1, latency2;
+  while (tries < 0 || tries-- > 0) {
+    if (ChainedWriteLatency(latency1, timeout) != Okay) continue;
+    if (ChainedWriteLatency(latency2, timeout) != Okay) continue;
+    m_HealthTests.Feed(latency1);
+    m_HealthTests.Feed(latency2);
+    totalGenerated += 2;
+    if (ExtractLatencyPair(m_Baseline, m_bMedianQuantiser, latency1, latency2, bit)) return Okay;
+  }
+#endif
   return FailedTotally;
 }
 
@@ -186,7 +731,7 @@ MeasurementResult CKernel::IsBurntOut(bool& burntOut, const int addr, const int
   burntOut = false;
   u64 temp;
   for (int i = 0; i < writes; ++i) {
-    const u8 expected = m_Random.GetNumber() % 256;
+    const u8 expected = GetRandomByte();
     const MeasurementResult result = MemWriteAndPoll(temp, addr, expected, timeout);
     if (result != Okay) return result;
     if (expected != MemRead(addr)) {
@@ -197,22 +742,6 @@ MeasurementResult CKernel::IsBurntOut(bool& burntOut, const int addr, const int
   return Okay;
 }
 
-MeasurementResult CKernel::BurnOut(const int addr, const int checkInterval, const int timeout) {
-  u64 temp;
-  MeasurementResult result;
-  bool burntOut;
-  for (int i = 0; ; ++i) {
-    result = MemWriteAndPoll(temp, addr, m_Random.GetNumber() % 256, timeout);
-    if (result != Okay) return result;
-    if (i % checkInterval == 0) {
-      result = IsBurntOut(burntOut, addr, 10, timeout);
-      if (result != Okay) return result;
-      if (burntOut) break;
-    }
-  }
-  return result;
-}
-
 MeasurementResult CKernel::DemoMode() {
   MeasurementResult result = Okay;
 
@@ -237,16 +766,24 @@ MeasurementResult CKernel::WriteLatencyRngTest() {
   const char* cFileNameDebug = fileNameDebug;
   m_Logger.Write(FromKernel, LogNotice, "Choosing debug file %s", cFileNameDebug);
 
-  FIL file;
+  COutputFile file;
   int idxDebug = 0;
   u64 newUptime;
 
-  constexpr int totalToGenerate = 500000;
+  const int totalToGenerate = static_cast<int>(GetParamNumber("trng_bits", 500000));
   constexpr int debugSteps = 10000;
+  const int debugCount = totalToGenerate / debugSteps + 1;
 
-  char generated[totalToGenerate];
-  u64 debugTimes[totalToGenerate / debugSteps];
-  int debugBits[totalToGenerate / debugSteps];
+  const auto generated = m_Arena.Allocate<char>(totalToGenerate);
+  const auto debugTimes = m_Arena.Allocate<u64>(debugCount);
+  const auto debugBits = m_Arena.Allocate<int>(debugCount);
+  const auto debugTemperatures = m_Arena.Allocate<unsigned>(debugCount);
+  const auto debugBaselines = m_Arena.Allocate<u64>(debugCount);
+  if (generated == nullptr || debugTimes == nullptr || debugBits == nullptr || debugTemperatures == nullptr ||
+      debugBaselines == nullptr) {
+    return ArenaExhausted("TRNG bits", totalToGenerate +
+                          debugCount * (2 * sizeof(u64) + sizeof(int) + sizeof(unsigned)));
+  }
 
   bool bit;
   int toGenerate = totalToGenerate;
@@ -254,16 +791,24 @@ MeasurementResult CKernel::WriteLatencyRngTest() {
   const u64 start = CTimer::GetClockTicks64();
   u64 blockStart = start;
   int blockGenerated = toGenerate;
+  // Recorded in the output, as they were sampled before the job started
+  unsigned fastStartBits = m_nFastStartBits - m_nFastStartTaken;
+  if (fastStartBits > static_cast<unsigned>(totalToGenerate)) fastStartBits = totalToGenerate;
+  m_HealthTests.Reset();
   while (toGenerate > 0) {
-    ExtractSingleBit(bit, totalGenerated);
+    // Bits sampled during start-up come first
+    if (!TakeFastStartBit(bit, totalGenerated)) ExtractSingleBit(bit, totalGenerated);
     // For more debug information:
     if (toGenerate % debugSteps == 0) {
       if (toGenerate < totalToGenerate) {
         newUptime = CTimer::GetClockTicks64();
         debugTimes[idxDebug] = newUptime - blockStart;
         debugBits[idxDebug] = totalGenerated - blockGenerated;
-        m_Logger.Write(FromKernel, LogNotice, "%lld µs, %d",
-                       debugTimes[idxDebug], debugBits[idxDebug]);
+        debugTemperatures[idxDebug] = GetTemperature();
+        debugBaselines[idxDebug] = m_Baseline.GetBaseline();
+        m_Logger.Write(FromKernel, LogNotice, "%lld µs, %d, %u m°C, baseline %llu",
+                       debugTimes[idxDebug], debugBits[idxDebug],
+                       debugTemperatures[idxDebug], debugBaselines[idxDebug]);
         blockStart = newUptime;
         ++idxDebug;
       }
@@ -277,24 +822,29 @@ MeasurementResult CKernel::WriteLatencyRngTest() {
   newUptime = CTimer::GetClockTicks64();
   debugTimes[idxDebug] = newUptime - blockStart;
   debugBits[idxDebug] = totalGenerated - blockGenerated;
-  m_Logger.Write(FromKernel, LogNotice, "%lld µs, %d",
-                 debugTimes[idxDebug], debugBits[idxDebug]);
+  debugTemperatures[idxDebug] = GetTemperature();
+  debugBaselines[idxDebug] = m_Baseline.GetBaseline();
+  m_Logger.Write(FromKernel, LogNotice, "%lld µs, %d, %u m°C, baseline %llu",
+                 debugTimes[idxDebug], debugBits[idxDebug],
+                 debugTemperatures[idxDebug], debugBaselines[idxDebug]);
 
   m_Logger.Write(FromKernel, LogNotice, "Time needed: %lld µs", newUptime - start);
-  m_Logger.Write(FromKernel, LogNotice, "Total bits generated: %d\n", totalGenerated);
+  m_Logger.Write(FromKernel, LogNotice, "Total bits generated: %d", totalGenerated);
+  m_Logger.Write(FromKernel, LogNotice, "Leading bits sampled during start-up: %u", fastStartBits);
+  m_Logger.Write(FromKernel, LogNotice, "Health test failures: RCT %u, APT %u\n",
+                 m_HealthTests.GetRepetitionFailures(), m_HealthTests.GetProportionFailures());
 
-  FRESULT Result = f_open(&file, fileNameBits, FA_WRITE | FA_CREATE_ALWAYS);
+  FRESULT Result = file.Open(fileNameBits, totalToGenerate);
   if (Result != FR_OK) {
     m_Logger.Write(FromKernel, LogPanic, "Cannot create file: %s (%d)", cFileNameBits, Result);
     result = FailedTotally;
   }
-  unsigned nBytesWritten;
-  Result = f_write(&file, generated, totalToGenerate, &nBytesWritten);
-  if (Result != FR_OK || nBytesWritten != totalToGenerate) {
+  Result = file.Write(generated, totalToGenerate);
+  if (Result != FR_OK) {
     m_Logger.Write(FromKernel, LogError, "Write error (%d)", Result);
     result = FailedTotally;
   }
-  Result = f_close(&file);
+  Result = file.Close();
   if (Result == FR_OK) {
     m_Logger.Write(FromKernel, LogNotice, "Successfully written bits to %s!", cFileNameBits);
   } else {
@@ -302,31 +852,35 @@ MeasurementResult CKernel::WriteLatencyRngTest() {
     result = FailedPartially;
   }
 
-  Result = f_open(&file, fileNameDebug, FA_WRITE | FA_CREATE_ALWAYS);
+  Result = file.Open(fileNameDebug, 64 * (debugCount + 4));
   if (Result != FR_OK) {
     m_Logger.Write(FromKernel, LogPanic, "Cannot create file: %s (%d)", cFileNameDebug, Result);
     result = FailedPartially;
   }
   CString Msg;
-  for (int nDebug = 0; nDebug < totalToGenerate / debugSteps; ++nDebug) {
-    Msg.Format("%lld µs, %d\n", debugTimes[nDebug], debugBits[nDebug]);
-    Result = f_write(&file, Msg, Msg.GetLength(), &nBytesWritten);
-    if (Result != FR_OK || nBytesWritten != Msg.GetLength()) {
+  for (int nDebug = 0; nDebug <= idxDebug; ++nDebug) {
+    Msg.Format("%lld µs, %d, %u m°C, baseline %llu\n", debugTimes[nDebug], debugBits[nDebug],
+               debugTemperatures[nDebug], debugBaselines[nDebug]);
+    Result = file.Write(Msg);
+    if (Result != FR_OK) {
       m_Logger.Write(FromKernel, LogError, "Write error (%d)", Result);
       result = FailedPartially;
       break;
     }
   }
 
-  Msg.Format("\nTime needed: %lld µs\nTotal bits generated: %d\n",
-             newUptime - start, totalGenerated);
-  Result = f_write(&file, Msg, Msg.GetLength(), &nBytesWritten);
-  if (Result != FR_OK || nBytesWritten != Msg.GetLength()) {
+  Msg.Format("\nTime needed: %lld µs\nTotal bits generated: %d\nLeading bits sampled during start-up: %u\n"
+             "Health test failures: RCT %u, APT %u\n",
+             newUptime - start, totalGenerated,
+             fastStartBits,
+             m_HealthTests.GetRepetitionFailures(), m_HealthTests.GetProportionFailures());
+  Result = file.Write(Msg);
+  if (Result != FR_OK) {
     m_Logger.Write(FromKernel, LogError, "Write error (%d)", Result);
     result = FailedPartially;
   }
 
-  Result = f_close(&file);
+  Result = file.Close();
   if (Result == FR_OK) {
     m_Logger.Write(FromKernel, LogNotice, "Successfully written debug data to %s!", cFileNameDebug);
   } else {
@@ -337,202 +891,72 @@ MeasurementResult CKernel::WriteLatencyRngTest() {
   return result;
 }
 
-MeasurementResult CKernel::WriteLatencyRngTest2() {
+MeasurementResult CKernel::WriteLatencyTrace() {
   MeasurementResult result = Okay;
 
-#define FILENAME MEM_NAME_SIMPLE "_%d_measure.log"
-  const CString fileName = GetFreeFile(DRIVE FILENAME);
+#define FILENAME_TRACE MEM_NAME_SIMPLE "_%d_trace.bin"
+  const CString fileName = GetFreeFile(DRIVE FILENAME_TRACE);
   const char* cFileName = fileName;
-  m_Logger.Write(FromKernel, LogNotice, "Choosing bits file %s", cFileName);
-
-  FIL file;
-
-  constexpr int tries1 = 20;
-  constexpr int tries2 = 8;
-
-  constexpr u8 num1s[] = {0x00, 0xff, 0xaa, 0x55, 0x73, 0xfc, 0xc5, 0x1c, 0x9d, 0x4c};
-  constexpr u8 num2s[] = {0xff, 0x00, 0x55, 0xaa, 0x73, 0x36, 0x29, 0x9f, 0x1b, 0xd8};
-  constexpr int bytes = sizeof(num1s) / sizeof(u8);
-
-#if MEM_CAN_BURN_OUT
-  constexpr int burnt1[] = {1, 9022, 26978, 44054, 60772};
-  constexpr int burntAmount1 = sizeof(burnt1) / sizeof(int);
-  constexpr int burnt2[] = {6, 10990, 31987, 54833, 64198};
-  constexpr int burntAmount2 = sizeof(burnt2) / sizeof(int);
-#endif
+  m_Logger.Write(FromKernel, LogNotice, "Choosing trace file %s", cFileName);
 
-  constexpr int sane1[] = {3609, 17625, 29463, 48071, 58244};
-  constexpr int saneAmount1 = sizeof(sane1) / sizeof(int);
-  constexpr int sane2[] = {7541, 24251, 36203, 49382, 60456};
-  constexpr int saneAmount2 = sizeof(sane2) / sizeof(int);
+  COutputFile file;
 
-#if MEM_CAN_BURN_OUT
-  const auto burntTimes1 = new u64[burntAmount1 * bytes * tries1];
-  const auto burntTimes2 = new u64[burntAmount2 * 256 * 256 * tries2];
-#endif
-  const auto saneTimes1 = new u64[saneAmount1 * bytes * tries1];
-  const auto saneTimes2 = new u64[saneAmount2 * 256 * 256 * tries2];
+  const unsigned totalSamples = GetParamNumber("trace_samples", 1000000);
+  constexpr int debugSteps = 100000;
 
-#if MEM_CAN_BURN_OUT
-  bool burntOut;
-  for (const int addr : burnt1) {
-    result = IsBurntOut(burntOut, addr);
-    if (result != Okay) return result;
-    if (!burntOut) {
-      result = BurnOut(addr);
-      if (result != Okay) return result;
-    }
-  }
-  for (const int addr : burnt2) {
-    result = IsBurntOut(burntOut, addr);
-    if (result != Okay) return result;
-    if (!burntOut) {
-      result = BurnOut(addr);
-      if (result != Okay) return result;
-    }
-  }
-#endif
+  const auto samples = m_Arena.Allocate<u16>(totalSamples);
+  if (samples == nullptr) return ArenaExhausted("trace samples", totalSamples * sizeof(u16));
 
-  int idx;
   u64 latency;
-  unsigned nBytesWritten;
-  CString Msg;
-
-#if MEM_CAN_BURN_OUT
-  idx = 0;
-  for (const int addr : burnt1) {
-    for (int j = 0; j < bytes; ++j) {
-      for (int k = 0; k < tries1; ++k) {
-        RandomWriteLatency(latency, addr, num1s[j], num2s[j]);
-        burntTimes1[idx++] = latency;
-      }
-    }
-  }
-  m_Logger.Write(FromKernel, LogNotice, "Burnt done");
-#endif
-
-  idx = 0;
-  for (const int addr : sane1) {
-    for (int j = 0; j < bytes; ++j) {
-      for (int k = 0; k < tries1; ++k) {
-        RandomWriteLatency(latency, addr, num1s[j], num2s[j]);
-        saneTimes1[idx++] = latency;
-      }
+  int failed = 0;
+  m_HealthTests.Reset();
+  const u64 start = CTimer::GetClockTicks64();
+  for (unsigned i = 0; i < totalSamples; ++i) {
+    if (ChainedWriteLatency(latency) == Okay) {
+      m_HealthTests.Feed(latency);
+      samples[i] = EncodeTraceSample(latency);
+    } else {
+      samples[i] = TRACE_INVALID_SAMPLE;
+      ++failed;
     }
-  }
-  m_Logger.Write(FromKernel, LogNotice, "Sane done");
-
-#if MEM_CAN_BURN_OUT
-  idx = 0;
-  for (const int addr : burnt2) {
-    for (int num1 = 0; num1 < 256; ++num1) {
-      for (int num2 = 0; num2 < 256; ++num2) {
-        for (int k = 0; k < tries2; ++k) {
-          RandomWriteLatency(latency, addr, num1, num2);
-          burntTimes2[idx++] = latency;
-        }
-      }
+    if ((i + 1) % debugSteps == 0) {
+      m_Logger.Write(FromKernel, LogNotice, "%u samples, %lld µs, %u m°C", i + 1,
+                     CTimer::GetClockTicks64() - start, GetTemperature());
     }
   }
-  m_Logger.Write(FromKernel, LogNotice, "Burnt full done");
-#endif
 
-  idx = 0;
-  for (const int addr : sane2) {
-    for (int num1 = 0; num1 < 256; ++num1) {
-      for (int num2 = 0; num2 < 256; ++num2) {
-        for (int k = 0; k < tries2; ++k) {
-          RandomWriteLatency(latency, addr, num1, num2);
-          saneTimes2[idx++] = latency;
-        }
-      }
-    }
-  }
-  m_Logger.Write(FromKernel, LogNotice, "Sane full done");
+  m_Logger.Write(FromKernel, LogNotice, "Time needed: %lld µs", CTimer::GetClockTicks64() - start);
+  m_Logger.Write(FromKernel, LogNotice, "Failed samples: %d", failed);
+  m_Logger.Write(FromKernel, LogNotice, "Health test failures: RCT %u, APT %u",
+                 m_HealthTests.GetRepetitionFailures(), m_HealthTests.GetProportionFailures());
 
-  FRESULT Result = f_open(&file, fileName, FA_WRITE | FA_CREATE_ALWAYS);
+  TTraceHeader header = {
+    {TRACE_MAGIC[0], TRACE_MAGIC[1], TRACE_MAGIC[2], TRACE_MAGIC[3]},
+    TRACE_VERSION,
+    sizeof(u16),
+    MEM_TYPE,
+    m_SPIClocks.Poll,
+    totalSamples,
+    SPI_ASYNC_BUILD ? TRACE_FLAG_SPI_ASYNC : 0u,
+    0
+  };
+
+  FRESULT Result = file.Open(fileName, sizeof(header) + static_cast<FSIZE_t>(totalSamples) * sizeof(u16));
   if (Result != FR_OK) {
     m_Logger.Write(FromKernel, LogPanic, "Cannot create file: %s (%d)", cFileName, Result);
-    result = FailedTotally;
+    return FailedTotally;
   }
-
-#if MEM_CAN_BURN_OUT
-  idx = 0;
-  for (const int addr : burnt1) {
-    for (int j = 0; j < bytes; ++j) {
-      for (int k = 0; k < tries1; ++k) {
-        Msg.Format("B,%d,%d,%d,%lld\n", addr, num1s[j], num2s[j], burntTimes1[idx++]);
-        Result = f_write(&file, Msg, Msg.GetLength(), &nBytesWritten);
-        if (Result != FR_OK || nBytesWritten != Msg.GetLength()) {
-          m_Logger.Write(FromKernel, LogError, "Write error (%d)", Result);
-          result = FailedPartially;
-          break;
-        }
-      }
-    }
-  }
-  m_Logger.Write(FromKernel, LogNotice, "Burnt written");
-#endif
-
-  idx = 0;
-  for (const int addr : sane1) {
-    for (int j = 0; j < bytes; ++j) {
-      for (int k = 0; k < tries1; ++k) {
-        Msg.Format("S,%d,%d,%d,%lld\n", addr, num1s[j], num2s[j], saneTimes1[idx++]);
-        Result = f_write(&file, Msg, Msg.GetLength(), &nBytesWritten);
-        if (Result != FR_OK || nBytesWritten != Msg.GetLength()) {
-          m_Logger.Write(FromKernel, LogError, "Write error (%d)", Result);
-          result = FailedPartially;
-          break;
-        }
-      }
-    }
-  }
-  m_Logger.Write(FromKernel, LogNotice, "Sane written");
-
-#if MEM_CAN_BURN_OUT
-  idx = 0;
-  for (const int addr : burnt2) {
-    for (int num1 = 0; num1 < 256; ++num1) {
-      for (int num2 = 0; num2 < 256; ++num2) {
-        for (int k = 0; k < tries2; ++k) {
-          Msg.Format("B,%d,%d,%d,%lld\n", addr, num1, num2, burntTimes2[idx++]);
-          Result = f_write(&file, Msg, Msg.GetLength(), &nBytesWritten);
-          if (Result != FR_OK || nBytesWritten != Msg.GetLength()) {
-            m_Logger.Write(FromKernel, LogError, "Write error (%d)", Result);
-            result = FailedPartially;
-            break;
-          }
-        }
-      }
-    }
-  }
-  m_Logger.Write(FromKernel, LogNotice, "Burnt full written");
-#endif
-
-  idx = 0;
-  for (const int addr : sane2) {
-    for (int num1 = 0; num1 < 256; ++num1) {
-      for (int num2 = 0; num2 < 256; ++num2) {
-        for (int k = 0; k < tries2; ++k) {
-          Msg.Format("S,%d,%d,%d,%lld\n", addr, num1, num2, saneTimes2[idx++]);
-          Result = f_write(&file, Msg, Msg.GetLength(), &nBytesWritten);
-          if (Result != FR_OK || nBytesWritten != Msg.GetLength()) {
-            m_Logger.Write(FromKernel, LogError, "Write error (%d)", Result);
-            result = FailedPartially;
-            break;
-          }
-        }
-      }
-    }
+  file.Write(&header, sizeof(header));
+  Result = file.Write(samples, totalSamples * sizeof(u16));
+  if (Result != FR_OK) {
+    m_Logger.Write(FromKernel, LogError, "Write error (%d)", Result);
+    result = FailedTotally;
   }
-  m_Logger.Write(FromKernel, LogNotice, "Sane full written");
-
-  Result = f_close(&file);
+  Result = file.Close();
   if (Result == FR_OK) {
-    m_Logger.Write(FromKernel, LogNotice, "Successfully written bits to %s!", cFileName);
+    m_Logger.Write(FromKernel, LogNotice, "Successfully written trace to %s!", cFileName);
   } else {
-    m_Logger.Write(FromKernel, LogPanic, "Cannot close bits file (%d)", Result);
+    m_Logger.Write(FromKernel, LogPanic, "Cannot close trace file (%d)", Result);
     result = FailedPartially;
   }
 
@@ -543,32 +967,43 @@ MeasurementResult CKernel::BurnOutCells() {
   MeasurementResult result = Okay;
 
   // Same cells as in WriteLatencyRngTest2
-  constexpr int sane[] = {3609, 17625, 29463, 48071, 58244, 7541, 24251, 36203, 49382, 60456};
-  constexpr int burnt[] = {1, 9022, 26978, 44054, 60772, 6, 10990, 31987, 54833, 64198};
+  TRawSweep sweeps[RAW_MAX_SWEEPS];
+  const unsigned sweepCount = LoadRawSweeps(sweeps);
 
   bool burntOut;
 
-  for (const int addr : sane) {
-    result = IsBurntOut(burntOut, addr);
-    if (result != Okay) return result;
-    if (burntOut) {
-      m_Logger.Write(FromKernel, LogNotice, "Cell %d burnt out, not good!", addr);
-    } else {
-      m_Logger.Write(FromKernel, LogNotice, "Cell %d sane", addr);
+  for (unsigned s = 0; s < sweepCount; ++s) {
+    if (sweeps[s].Type != 'S') continue;
+    for (unsigned c = 0; c < sweeps[s].CellCount; ++c) {
+      const int addr = static_cast<int>(sweeps[s].Cells[c]);
+      result = IsBurntOut(burntOut, addr);
+      if (result != Okay) return result;
+      if (burntOut) {
+        m_Logger.Write(FromKernel, LogNotice, "Cell %d burnt out, not good!", addr);
+      } else {
+        m_Logger.Write(FromKernel, LogNotice, "Cell %d sane", addr);
+      }
     }
   }
 
-  for (const int addr : burnt) {
-    result = IsBurntOut(burntOut, addr);
-    if (result != Okay) return result;
-    if (!burntOut) {
-      result = BurnOut(addr);
-      if (result != Okay) return result;
+#if !MEM_CAN_BURN_OUT
+  m_Logger.Write(FromKernel, LogError, "Burn-out is not supported for %s, no cells were stressed", MEM_NAME);
+  return FailedTotally;
+#endif
+
+  // All burnt cells in one campaign, so they are stressed interleaved
+  u32 cells[BURNOUT_MAX_CELLS];
+  unsigned cellCount = 0;
+  for (unsigned s = 0; s < sweepCount; ++s) {
+    if (sweeps[s].Type != 'B') continue;
+    for (unsigned c = 0; c < sweeps[s].CellCount; ++c) {
+      cells[cellCount++] = sweeps[s].Cells[c];
     }
-    m_Logger.Write(FromKernel, LogNotice, "Cell %d burnt out", addr);
   }
+  result = BurnOutCampaign(cells, cellCount);
+  if (result != Okay) return result;
 
-  m_Logger.Write(FromKernel, LogNotice, "Burn out process complete");
+  m_Logger.Write(FromKernel, LogNotice, "Burn out process complete (%u cells)", cellCount);
 
   return result;
 }
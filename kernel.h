@@ -13,13 +13,36 @@
 #include <circle/types.h>
 #include <SDCard/emmc.h>
 #include <fatfs/ff.h>
+#include <Properties/propertiesfile.h>
+#include "burnout_campaign.h"
+#include "entropy_pool.h"
+#include "extractor.h"
+#include "health_tests.h"
+#include "latency_ring.h"
+#include "measurement_arena.h"
+#include "measurement_format.h"
+#include "sampler_core.h"
 #include "spi_memory.h"
+#include "wear_tracker.h"
+#if SPI_ASYNC
+#include "spi_queue.h"
+#define SPI_ASYNC_BUILD        1u            // Recorded in trace and raw headers, as it changes the latencies
+#else
+#define SPI_ASYNC_BUILD        0u
+#endif
 
 #define SPI_MASTER_DEVICE      0             // 0, 4, 5, 6 on Raspberry Pi 4; 0 otherwise
 #define SPI_CPOL               0
 #define SPI_CPHA               0
 #define SPI_CHIP_SELECT        0             // 0 or 1, or 2 (for SPI1)
 
+#define CHAIN_LENGTH_DEFAULT   2             // Writes per cell in ChainedWriteLatency: one sample per address
+
+#define FAST_START_MAX_BITS    (1 << 20)     // Bits buffered while the SD card is initialised
+
+#define JOBS_MAX               32
+#define JOBS_LIST_MAX          512
+
 static constexpr char FromKernel[] = "kernel";
 
 enum TShutdownMode {
@@ -53,14 +76,62 @@ public:
 
   static CString GetFreeFile(const char* pattern);
 
+  // First index at which none of the files patterns[0] .. patterns[count - 1] exists
+  static int GetFreeIndex(const char* const* patterns, unsigned count);
+
+  // Parameters of the running job (<job>_<name>) take precedence over global ones
+  unsigned GetParamNumber(const char* name, unsigned defaultValue) const;
+
+  const char* GetParamString(const char* name, const char* defaultValue) const;
+
   // Kernel functionality
 
   void IndicateStop(MeasurementResult);
 
+  // Runs the mode of the given job; nullptr runs the global mode
+  MeasurementResult RunJob(const char* name);
+
+  static const char* GetResultName(MeasurementResult result);
+
+  MeasurementResult SeedEntropyPool(int bits = ENTROPY_POOL_SEED_BITS, int timeout = -1);
+
+  u8 GetRandomByte();
+
+  // SoC temperature in millidegrees Celsius (0 if unknown)
+  static unsigned GetTemperature();
+
+  // Identifies the board in provenance headers (0 if unknown)
+  static u64 GetBoardSerial();
+
+  // Quantises with the selected quantiser (lsb or median); always tracks the latency baseline
+  bool Quantise(u64 latency);
+
+  // Runs on the sampler core until stopped: extracts bits into the fast start buffer
+  void FastStartSampling();
+
+  // Returns the next bit sampled during start-up, if any is left
+  bool TakeFastStartBit(bool& bit, int& totalGenerated);
+
+  // Whether the job's settings are the defaults the bits during start-up were sampled with
+  bool HasFastStartSettings() const;
+
+  // Frees the bits sampled during start-up that were not taken
+  void ReleaseFastStartBits();
+
   MeasurementResult RandomWriteLatency(u64& write_latency, int addr, int num1, int num2, int timeout = -1);
 
+  // Also returns the latency of the first write, whose predecessor is the previous value of the cell
+  MeasurementResult RandomWriteLatency(u64& first_latency, u64& write_latency, int addr, int num1, int num2,
+                                       int timeout = -1);
+
   MeasurementResult RandomWriteLatency(u64& write_latency, int timeout = -1);
 
+  // Writes random values to the same cell m_nChainLength times; every write but the first is a sample
+  MeasurementResult ChainedWriteLatency(u64& write_latency, int timeout = -1);
+
+  // Uniformly random address, or the less worn of two if wear leveling is enabled
+  u32 SelectRandomAddress();
+
   MeasurementResult WriteLatencyRandomBit(bool& bit, int timeout = -1);
 
   MeasurementResult ExtractSingleBit(bool& bit, int& totalGenerated, int tries = -1, int timeout = -1);
@@ -68,9 +139,13 @@ public:
   MeasurementResult IsBurntOut(bool& burntOut, int addr, int writes = 10, int timeout = -1);
 
   /**
-   * WARNING! THIS PERMANENTLY DAMAGES THE GIVEN CELL. USE CAREFULLY!
+   * WARNING! THIS PERMANENTLY DAMAGES THE GIVEN CELLS. USE CAREFULLY!
+   * Interleaved stress writes until every cell is burnt out; progress is kept in burnout_file and resumed.
    */
-  MeasurementResult BurnOut(int addr, int checkInterval = 1000, int timeout = -1);
+  MeasurementResult BurnOutCampaign(const u32* cells, unsigned count, int timeout = -1);
+
+  // Writes and reads back 0x00 and 0xFF; stuck is set if either does not read back
+  MeasurementResult VerifyStressPatterns(bool& stuck, u32 addr, int timeout);
 
   MeasurementResult DemoMode();
 
@@ -78,6 +153,20 @@ public:
 
   MeasurementResult WriteLatencyRngTest2();
 
+  MeasurementResult WriteLatencyTrace();
+
+  MeasurementResult PageWriteStudy();
+
+  MeasurementResult BenchMode();
+
+  MeasurementResult RealtimeMode();
+
+  // Sequential and restart datasets of raw samples for the NIST SP 800-90B assessment tools
+  MeasurementResult SP80090BMode();
+
+  // Runs on the sampler core until stopped: chained measurements into m_pLatencyRing
+  void RealtimeSampling();
+
   MeasurementResult BurnOutCells();
 
   // SPI Memory
@@ -86,20 +175,93 @@ public:
 
   void ResetWriteEnable();
 
-  static MemoryStatusRegister ParseStatusRegister(u8 statusRegister);
-
   void ReadStatusRegister(MemoryStatusRegister* statusRegister);
 
   void SetWriteEnableLatch(bool check_register);
 
   MeasurementResult WIPPollingCycles(u64& cycles, int timeout = -1);
 
+  // Also returns the longest time between two polls in µs
+  MeasurementResult WIPPollingCyclesTimed(u64& cycles, unsigned& maxGap, int timeout = -1);
+
   void MemWrite(u32 adr, u8 value);
 
   u8 MemRead(u32 adr);
 
   MeasurementResult MemWriteAndPoll(u64& cycles, u32 adr, u8 value, int timeout = -1);
 
+  // Writes count bytes (at most up to the end of the page) with a single WR command
+  void MemWritePage(u32 adr, const u8* values, unsigned count);
+
+  MeasurementResult MemWritePageAndPoll(u64& cycles, u32 adr, const u8* values, unsigned count, int timeout = -1);
+
+#if SPI_ASYNC
+  // Asynchronous SPI Memory
+
+  struct TLatencySample {
+    volatile boolean Done;
+    volatile boolean Status;
+    volatile u64 Latency;
+    volatile boolean WriteFailed; // WREN or WR failed (Status is FALSE then, too)
+  };
+
+  // pCallback is called with &sample once the poll has completed
+  void StartMemWriteAndPoll(u32 adr, u8 value, TSPIRequestCallback* pCallback, TLatencySample& sample,
+                            int timeout = -1);
+
+  void StartChainedWriteLatency(TLatencySample& sample, int timeout = -1);
+
+  // Gives up on the sample after SPI_QUEUE_TIMEOUT_US
+  MeasurementResult WaitLatencySample(u64& write_latency, TLatencySample& sample);
+
+  // Completes the sample as failed; its pending requests no longer report to it
+  void AbandonLatencySample(TLatencySample& sample);
+
+  // Waits for the pair ExtractSingleBit keeps in flight and drops it; called before every other SPI access
+  void DiscardPendingPair();
+#endif
+
+private:
+  // Splits the comma separated job list into buffer; returns the number of jobs
+  static unsigned ParseJobList(const char* list, char* buffer, const char** jobs);
+
+  // Parses a comma separated list of numbers; returns the number of entries
+  static unsigned ParseNumberList(const char* list, unsigned* numbers, unsigned maxNumbers);
+
+  void WriteJobSummary(const char** jobs, const MeasurementResult* results, const u64* durations, unsigned count);
+
+  // Emulates a reboot for the SP 800-90B restart dataset
+  void RestartSampler();
+
+  // Raw samples (the lower bits of chained write latencies), one per byte; failed measurements are retried
+  MeasurementResult AcquireRawSamples(u8* samples, unsigned count, u8 mask, unsigned& failed);
+
+  // Logs that a buffer does not fit into the arena budget of the job; returns FailedTotally
+  MeasurementResult ArenaExhausted(const char* pBuffer, size_t nBytes);
+
+  // Cell lists of raw mode from params.properties (raw_<sweep>), in measurement order; returns the number of sweeps
+  unsigned LoadRawSweeps(TRawSweep* sweeps);
+
+  // Reads the per-command SPI clocks from params.properties (spi_freq, spi_freq_<command>)
+  void LoadClockProfile();
+
+  int SPIWrite(const void* data, unsigned len, unsigned clock);
+
+  int SPIWriteRead(const void* data, void* reg, unsigned len, unsigned clock);
+
+#if !SPI_ASYNC
+  void SetSPIClock(unsigned clock);
+#endif
+
+#if SPI_ASYNC
+  // Marks the sample failed if WREN or WR failed
+  static void WriteStepCallback(const TSPIRequest* pRequest, void* pParam);
+
+  static void FirstWriteCallback(const TSPIRequest* pRequest, void* pParam);
+
+  static void LatencyCallback(const TSPIRequest* pRequest, void* pParam);
+#endif
+
 private:
   // do not change this order
   CActLED m_ActLED;
@@ -110,9 +272,48 @@ private:
   CInterruptSystem m_Interrupt;
   CTimer m_Timer;
   CLogger m_Logger;
+#if SPI_ASYNC
+  CSPIRequestQueue m_SPIQueue;
+#else
   CSPIMaster m_SPIMaster;
+  unsigned m_nSPIClock;
+#endif
+  TSPIClockProfile m_SPIClocks;
+#if SAMPLER_CORE
+  CSamplerCore m_SamplerCore;
+#endif
   CBcmRandomNumberGenerator m_Random;
+  CEntropyPool m_EntropyPool;
+  CHealthTests m_HealthTests;
+  CLatencyBaseline m_Baseline;
+  CMeasurementArena m_Arena; // Measurement buffers of the current job
+  bool m_bMedianQuantiser;
+  CWearTracker m_WearTracker;
+  bool m_bWearLeveling;
+
+  unsigned m_nChainLength;
+  u32 m_nChainAddr;
+  unsigned m_nChainRemaining; // Samples left at m_nChainAddr
+
+  // Written by the sampler core during start-up
+  u8* m_pFastStartBits;
+  volatile unsigned m_nFastStartBits;
+  volatile int m_nFastStartRaw;
+  volatile bool m_bFastStartFailed;
+  unsigned m_nFastStartTaken;
+
+  // Shared with the sampler core in real-time mode
+  CLatencyRing* m_pLatencyRing;
+  unsigned m_nStallThreshold; // µs
   CGPIOPin m_WEPin;
   CEMMCDevice m_EMMC;
   FATFS m_FileSystem;
+  CPropertiesFile* m_pProperties;
+  const char* m_pJobName;
+
+#if SPI_ASYNC
+  // Pair of measurements kept in flight by ExtractSingleBit
+  TLatencySample m_PendingPair[2];
+  bool m_bPairPending;
+#endif
 };
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <circle/synchronize.h>
+#include <circle/types.h>
+
+#define LATENCY_RING_SIZE      (1 << 16)   // Entries; must be a power of two
+
+// Entry layout: latency in the lower 16 bits (saturated), flags above
+#define LATENCY_RING_LATENCY   0x0000FFFFu
+#define LATENCY_RING_DROPS     0x1FFFFFFFu // Number of dropped entries of a LATENCY_RING_DROPPED entry
+#define LATENCY_RING_DROPPED   0x20000000u // Stands for entries dropped because the ring was full
+#define LATENCY_RING_STALLED   0x40000000u // The measurement was interrupted (see CKernel::RealtimeSampling)
+#define LATENCY_RING_FAILED    0x80000000u // The poll timed out
+
+/**
+ * Single producer, single consumer ring of latency samples shared between two cores.
+ * The producer never blocks: entries pushed into a full ring are dropped and counted, and a
+ * LATENCY_RING_DROPPED entry takes their place as soon as there is room again, so the consumer
+ * sees the gap.
+ */
+class CLatencyRing {
+public:
+  CLatencyRing() : m_nIn(0), m_nOut(0), m_nDropped(0), m_nPendingDrops(0) {}
+
+  void Reset() {
+    m_nIn = 0;
+    m_nOut = 0;
+    m_nDropped = 0;
+    m_nPendingDrops = 0;
+  }
+
+  // Producer side
+  bool Push(const u32 entry) {
+    if (m_nPendingDrops > 0) {
+      if (!Insert(LATENCY_RING_DROPPED | m_nPendingDrops)) return Drop();
+      m_nPendingDrops = 0;
+    }
+    return Insert(entry) || Drop();
+  }
+
+  // Consumer side
+  bool Pop(u32& entry) {
+    const unsigned out = m_nOut;
+    if (out == m_nIn) return false;
+    DataMemBarrier();
+    entry = m_Entries[out & (LATENCY_RING_SIZE - 1)];
+    DataMemBarrier();
+    m_nOut = out + 1;
+    return true;
+  }
+
+  unsigned GetDropped() const {
+    return m_nDropped;
+  }
+
+private:
+  bool Insert(const u32 entry) {
+    const unsigned in = m_nIn;
+    if (in - m_nOut == LATENCY_RING_SIZE) return false;
+    m_Entries[in & (LATENCY_RING_SIZE - 1)] = entry;
+    DataMemBarrier();
+    m_nIn = in + 1;
+    return true;
+  }
+
+  bool Drop() {
+    ++m_nDropped;
+    if (m_nPendingDrops < LATENCY_RING_DROPS) ++m_nPendingDrops;
+    return false;
+  }
+
+private:
+  u32 m_Entries[LATENCY_RING_SIZE];
+  volatile unsigned m_nIn;
+  volatile unsigned m_nOut;
+  volatile unsigned m_nDropped;
+  unsigned m_nPendingDrops; // Producer only
+};
@@ -0,0 +1,51 @@
+//
+// measurement_arena.cpp
+//
+#include "measurement_arena.h"
+
+#include <circle/memory.h>
+#include <circle/new.h>
+
+CMeasurementArena::CMeasurementArena()
+  : m_pBuffer(nullptr),
+    m_nSize(0),
+    m_nLimit(0),
+    m_nUsed(0),
+    m_nHighWater(0) {}
+
+CMeasurementArena::~CMeasurementArena() {
+  delete[] m_pBuffer;
+}
+
+bool CMeasurementArena::Initialize() {
+  const size_t free = CMemorySystem::Get()->GetHeapFreeSpace(HEAP_LOW);
+  if (free <= ARENA_HEAP_RESERVE + ARENA_ALIGNMENT) return false;
+
+  // Rounded down to whole cache lines, plus one for aligning the start
+  m_nSize = (free - ARENA_HEAP_RESERVE - ARENA_ALIGNMENT) & ~static_cast<size_t>(ARENA_ALIGNMENT - 1);
+  m_pBuffer = new (HEAP_LOW) u8[m_nSize + ARENA_ALIGNMENT];
+  if (m_pBuffer == nullptr) {
+    m_nSize = 0;
+    return false;
+  }
+
+  Reset();
+  return true;
+}
+
+void CMeasurementArena::Reset(const size_t nBudget) {
+  m_nUsed = 0;
+  m_nLimit = nBudget != 0 && nBudget < m_nSize ? nBudget : m_nSize;
+}
+
+void* CMeasurementArena::AllocateBytes(const size_t nSize) {
+  const size_t aligned = (nSize + ARENA_ALIGNMENT - 1) & ~static_cast<size_t>(ARENA_ALIGNMENT - 1);
+  if (aligned < nSize || aligned > m_nLimit - m_nUsed) return nullptr;
+
+  const uintptr start = (reinterpret_cast<uintptr>(m_pBuffer) + ARENA_ALIGNMENT - 1) &
+                        ~static_cast<uintptr>(ARENA_ALIGNMENT - 1);
+  void* p = reinterpret_cast<void*>(start + m_nUsed);
+  m_nUsed += aligned;
+  if (m_nUsed > m_nHighWater) m_nHighWater = m_nUsed;
+  return p;
+}
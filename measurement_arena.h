@@ -0,0 +1,61 @@
+#pragma once
+
+#include <circle/types.h>
+
+#define ARENA_ALIGNMENT     64                 // Cache line
+#define ARENA_HEAP_RESERVE  (16 * 1024 * 1024) // Left on the heap for FatFs, output buffers, strings etc.
+
+/**
+ * Bump allocator for the measurement buffers of the modes.
+ * One block is taken from the heap at boot. Allocations are only ever freed all at once by Reset(),
+ * which RunJob() calls before every job, so nothing leaks across jobs, however a mode returns.
+ * Each job may be restricted to a budget, i.e. a part of the arena.
+ */
+class CMeasurementArena {
+public:
+  CMeasurementArena();
+
+  ~CMeasurementArena();
+
+  // Takes all but ARENA_HEAP_RESERVE bytes of the free heap
+  bool Initialize();
+
+  // Frees all allocations; nBudget limits the next allocations (0: the whole arena)
+  void Reset(size_t nBudget = 0);
+
+  // Uninitialised memory for nCount objects, or nullptr if they do not fit into the budget
+  template <typename T>
+  T* Allocate(const size_t nCount) {
+    if (nCount > static_cast<size_t>(-1) / sizeof(T)) return nullptr;
+    return static_cast<T*>(AllocateBytes(nCount * sizeof(T)));
+  }
+
+  size_t GetSize() const {
+    return m_nSize;
+  }
+
+  // Bytes still available to the current job
+  size_t GetAvailable() const {
+    return m_nLimit - m_nUsed;
+  }
+
+  // Bytes allocated by the current job
+  size_t GetUsed() const {
+    return m_nUsed;
+  }
+
+  // Most bytes any job has allocated since boot
+  size_t GetHighWater() const {
+    return m_nHighWater;
+  }
+
+private:
+  void* AllocateBytes(size_t nSize);
+
+private:
+  u8* m_pBuffer;
+  size_t m_nSize;
+  size_t m_nLimit;
+  size_t m_nUsed;
+  size_t m_nHighWater;
+};
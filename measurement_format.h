@@ -0,0 +1,94 @@
+#pragma once
+
+#include <circle/types.h>
+
+// Longest row of FormatMeasurementRow() including the newline: type, u32, two u8, u64, u8 and u64 with separators
+#define MEASUREMENT_ROW_MAX  72
+static_assert(MEASUREMENT_ROW_MAX >= 1 + 1 + 10 + 1 + 3 + 1 + 3 + 1 + 20 + 1 + 3 + 1 + 20 + 1,
+              "FormatMeasurementRow() may overrun its buffer");
+
+// Writes value in decimal; returns the number of characters (no terminating zero)
+inline unsigned FormatDecimal(char* buffer, u64 value) {
+  char digits[20];
+  unsigned count = 0;
+  do {
+    digits[count++] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  for (unsigned i = 0; i < count; ++i) buffer[i] = digits[count - 1 - i];
+  return count;
+}
+
+// One row of the raw mode measurement file: "type,addr,num1,num2,latency,prev,first_latency\n"
+// Returns the length; buffer must hold MEASUREMENT_ROW_MAX characters
+inline unsigned FormatMeasurementRow(char* buffer, const char type, const u32 addr, const u8 num1, const u8 num2,
+                                     const u64 latency, const u8 prev, const u64 firstLatency) {
+  char* p = buffer;
+  *p++ = type;
+  *p++ = ',';
+  p += FormatDecimal(p, addr);
+  *p++ = ',';
+  p += FormatDecimal(p, num1);
+  *p++ = ',';
+  p += FormatDecimal(p, num2);
+  *p++ = ',';
+  p += FormatDecimal(p, latency);
+  *p++ = ',';
+  p += FormatDecimal(p, prev);
+  *p++ = ',';
+  p += FormatDecimal(p, firstLatency);
+  *p++ = '\n';
+  return static_cast<unsigned>(p - buffer);
+}
+
+// Raw mode (WriteLatencyRngTest2) files start with a provenance header and end with a trailer:
+// # raw_measurement,version=1,shard=<index>/<count>,...,<sweep>=<cells>/<pairs>/<tries>,...
+// # end,rows=<rows>
+#define RAW_HEADER          "# raw_measurement"
+#define RAW_TRAILER         "# end"
+#define RAW_VERSION         1
+
+#define RAW_MAX_CELLS       64
+#define RAW_MAX_PAIRS       16
+#define RAW_FULL_PAIRS      (256 * 256) // PairCount of a sweep over all byte pairs
+#define RAW_MAX_SWEEPS      4
+
+/**
+ * One part of the raw matrix: Tries samples of every (cell, num1, num2) combination, cell by cell.
+ * Shards split the combinations of every sweep into contiguous ranges.
+ */
+struct TRawSweep {
+  char Type;   // 'B' (burnt out cells) or 'S' (sane cells)
+  const char* Name;
+  unsigned CellCount;
+  u32 Cells[RAW_MAX_CELLS];
+  unsigned PairCount; // RAW_FULL_PAIRS or the number of Num1s/Num2s
+  u8 Num1s[RAW_MAX_PAIRS];
+  u8 Num2s[RAW_MAX_PAIRS];
+  unsigned Tries;
+
+  u32 GetCombinations() const {
+    return CellCount * PairCount;
+  }
+
+  u32 GetCell(const u32 combination) const {
+    return Cells[combination / PairCount];
+  }
+
+  u8 GetNum1(const u32 combination) const {
+    const u32 pair = combination % PairCount;
+    return PairCount == RAW_FULL_PAIRS ? static_cast<u8>(pair >> 8) : Num1s[pair];
+  }
+
+  u8 GetNum2(const u32 combination) const {
+    const u32 pair = combination % PairCount;
+    return PairCount == RAW_FULL_PAIRS ? static_cast<u8>(pair & 0xFF) : Num2s[pair];
+  }
+
+  // Combinations [first, first + count) belong to shard index of shards
+  void GetShard(const unsigned index, const unsigned shards, u32& first, u32& count) const {
+    const u64 combinations = GetCombinations();
+    first = static_cast<u32>(combinations * index / shards);
+    count = static_cast<u32>(combinations * (index + 1) / shards) - first;
+  }
+};
@@ -13,7 +13,9 @@
 #define MEM_ADR_SEND                2
 #define MEM_SIZE_ADR                ((u32)65536)
 #define MEM_ACCESS_WIDTH_BIT        8
+#define MEM_PAGE_SIZE               256
 #define MEM_ACCESS_TIME_NS          ((u32)150)
+#define MEM_SPI_FREQ_MAX            ((u32)1000000) // fSCK in the AC characteristics of the datasheet above
 #define MEM_CAN_BURN_OUT            1
 
 #elif MEM_TYPE == RERAM_FUJITSU_MB85AS4MTPF_G_BCERE1
@@ -24,7 +26,9 @@
 #define MEM_ADR_SEND                3
 #define MEM_SIZE_ADR                ((u32)524288)
 #define MEM_ACCESS_WIDTH_BIT        8
+#define MEM_PAGE_SIZE               256
 #define MEM_ACCESS_TIME_NS          ((u32)150)
+#define MEM_SPI_FREQ_MAX            ((u32)5000000) // fSCK in the AC characteristics of the datasheet above
 #define MEM_CAN_BURN_OUT            0 // TODO: Was not yet able to burn it out
 
 #else
@@ -32,3 +36,20 @@
 #error MEM_TYPE NOT DEFINED
 
 #endif
+
+// Clocks above MEM_SPI_FREQ_MAX are used as given (the Adesto chip has run at 3.12 MHz), but logged
+#define MEM_SPI_FREQ_DEFAULT        ((u32)SPI_FREQ)
+
+// Default SPI clock per command; a chip may define its own above, params.properties overrides them
+#ifndef MEM_SPI_FREQ_WREN
+#define MEM_SPI_FREQ_WREN           MEM_SPI_FREQ_DEFAULT
+#endif
+#ifndef MEM_SPI_FREQ_WRITE
+#define MEM_SPI_FREQ_WRITE          MEM_SPI_FREQ_DEFAULT
+#endif
+#ifndef MEM_SPI_FREQ_POLL
+#define MEM_SPI_FREQ_POLL           MEM_SPI_FREQ_DEFAULT
+#endif
+#ifndef MEM_SPI_FREQ_READ
+#define MEM_SPI_FREQ_READ           MEM_SPI_FREQ_DEFAULT
+#endif
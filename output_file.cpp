@@ -0,0 +1,95 @@
+//
+// output_file.cpp
+//
+#include "output_file.h"
+
+#include <circle/util.h>
+
+COutputFile::COutputFile()
+  : m_File(),
+    m_bOpen(false),
+    m_Error(FR_OK),
+    m_pBuffer(new u8[OUTPUT_FILE_BUFFER_SIZE]),
+    m_nBuffered(0),
+    m_nWritten(0) {}
+
+COutputFile::~COutputFile() {
+  if (m_bOpen) Close();
+  delete[] m_pBuffer;
+}
+
+FRESULT COutputFile::Open(const char* pFileName, const FSIZE_t nPreallocate) {
+  m_Error = f_open(&m_File, pFileName, FA_WRITE | FA_CREATE_ALWAYS);
+  if (m_Error != FR_OK) return m_Error;
+  m_bOpen = true;
+  m_nBuffered = 0;
+  m_nWritten = 0;
+
+  if (nPreallocate > 0) {
+    // Whole buffers only, so that the last flush stays inside the allocation
+    const FSIZE_t nSize = (nPreallocate + OUTPUT_FILE_BUFFER_SIZE - 1)
+                          / OUTPUT_FILE_BUFFER_SIZE * OUTPUT_FILE_BUFFER_SIZE;
+#if FF_USE_EXPAND
+    if (f_expand(&m_File, nSize, 1) == FR_OK) return FR_OK;
+    // Not enough contiguous space; fall back to a fragmented allocation
+#endif
+    m_Error = f_lseek(&m_File, nSize);
+    if (m_Error == FR_OK) m_Error = f_lseek(&m_File, 0);
+  }
+
+  return m_Error;
+}
+
+FRESULT COutputFile::Write(const void* pData, unsigned nLength) {
+  if (m_Error != FR_OK) return m_Error;
+
+  const auto* pIn = static_cast<const u8*>(pData);
+  while (nLength > 0) {
+    unsigned nChunk = OUTPUT_FILE_BUFFER_SIZE - m_nBuffered;
+    if (nChunk > nLength) nChunk = nLength;
+    memcpy(m_pBuffer + m_nBuffered, pIn, nChunk);
+    m_nBuffered += nChunk;
+    pIn += nChunk;
+    nLength -= nChunk;
+    if (m_nBuffered == OUTPUT_FILE_BUFFER_SIZE) {
+      m_Error = FlushBuffer();
+      if (m_Error != FR_OK) return m_Error;
+    }
+  }
+
+  return FR_OK;
+}
+
+FRESULT COutputFile::Write(const char* pString) {
+  return Write(pString, strlen(pString));
+}
+
+FRESULT COutputFile::Close() {
+  if (!m_bOpen) return m_Error;
+
+  FRESULT Result = m_Error;
+  if (Result == FR_OK && m_nBuffered > 0) Result = FlushBuffer();
+  // Drop the unused part of the preallocation
+  if (Result == FR_OK) Result = f_truncate(&m_File);
+  const FRESULT CloseResult = f_close(&m_File);
+  if (Result == FR_OK) Result = CloseResult;
+
+  m_bOpen = false;
+  m_Error = Result;
+  return Result;
+}
+
+FSIZE_t COutputFile::GetSize() const {
+  return m_nWritten + m_nBuffered;
+}
+
+FRESULT COutputFile::FlushBuffer() {
+  unsigned nBytesWritten;
+  const FRESULT Result = f_write(&m_File, m_pBuffer, m_nBuffered, &nBytesWritten);
+  if (Result != FR_OK) return Result;
+  if (nBytesWritten != m_nBuffered) return FR_DENIED; // Disk full
+
+  m_nWritten += m_nBuffered;
+  m_nBuffered = 0;
+  return FR_OK;
+}
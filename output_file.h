@@ -0,0 +1,43 @@
+#pragma once
+
+#include <circle/types.h>
+#include <fatfs/ff.h>
+
+#define OUTPUT_FILE_BUFFER_SIZE  (64 * 1024) // Must be a multiple of the sector size
+
+/**
+ * Buffered writer for measurement output on the SD card.
+ * The file is preallocated (contiguously if FF_USE_EXPAND is enabled) and the buffer is only ever
+ * submitted as whole, sector-aligned blocks; the unused preallocation is truncated on Close().
+ * Errors are sticky: once a call failed, all following calls return the same error.
+ */
+class COutputFile {
+public:
+  COutputFile();
+
+  ~COutputFile();
+
+  FRESULT Open(const char* pFileName, FSIZE_t nPreallocate = 0);
+
+  FRESULT Write(const void* pData, unsigned nLength);
+
+  FRESULT Write(const char* pString);
+
+  // Flushes, truncates and closes the file
+  FRESULT Close();
+
+  // Number of bytes written so far (including buffered ones)
+  FSIZE_t GetSize() const;
+
+private:
+  FRESULT FlushBuffer();
+
+private:
+  FIL m_File;
+  bool m_bOpen;
+  FRESULT m_Error;
+
+  u8* m_pBuffer;
+  unsigned m_nBuffered;
+  FSIZE_t m_nWritten;
+};
@@ -0,0 +1,131 @@
+//
+// page_study.cpp
+//
+#include "kernel.h"
+
+#include "mt19937ar.h"
+#include "output_file.h"
+#include "statistics.h"
+
+#define DRIVE        "SD:"
+
+enum TPagePattern {
+  // Independent random bytes for both writes
+  PagePatternRandom,
+  // Random bytes, then their complement (every bit switches)
+  PagePatternFlip,
+  // 0x00, then 0xFF
+  PagePatternSolid,
+  // 0xAA, then 0x55
+  PagePatternChecker
+};
+
+static TPagePattern ParsePagePattern(const char* name) {
+  const CString pattern(name);
+  if (pattern.Compare("flip") == 0) return PagePatternFlip;
+  if (pattern.Compare("solid") == 0) return PagePatternSolid;
+  if (pattern.Compare("checker") == 0) return PagePatternChecker;
+  return PagePatternRandom;
+}
+
+static void FillPagePattern(const TPagePattern pattern, u8* first, u8* second, const unsigned count) {
+  for (unsigned i = 0; i < count; ++i) {
+    switch (pattern) {
+    case PagePatternRandom:
+      first[i] = static_cast<u8>(genrand_range(0, 256));
+      second[i] = static_cast<u8>(genrand_range(0, 256));
+      break;
+    case PagePatternFlip:
+      first[i] = static_cast<u8>(genrand_range(0, 256));
+      second[i] = static_cast<u8>(~first[i]);
+      break;
+    case PagePatternSolid:
+      first[i] = 0x00;
+      second[i] = 0xFF;
+      break;
+    case PagePatternChecker:
+      first[i] = 0xAA;
+      second[i] = 0x55;
+      break;
+    }
+  }
+}
+
+MeasurementResult CKernel::PageWriteStudy() {
+  MeasurementResult result = Okay;
+
+#define FILENAME_PAGE MEM_NAME_SIMPLE "_%d_page.csv"
+  const CString fileName = GetFreeFile(DRIVE FILENAME_PAGE);
+  const char* cFileName = fileName;
+  m_Logger.Write(FromKernel, LogNotice, "Choosing page study file %s", cFileName);
+
+  const char* cPattern = GetParamString("page_pattern", "random");
+  const TPagePattern pattern = ParsePagePattern(cPattern);
+  unsigned samplesPerSize = GetParamNumber("page_samples", 10000);
+  if (samplesPerSize == 0) samplesPerSize = 1;
+  unsigned maxBytes = GetParamNumber("page_max_bytes", MEM_PAGE_SIZE);
+  if (maxBytes > MEM_PAGE_SIZE) maxBytes = MEM_PAGE_SIZE;
+  m_Logger.Write(FromKernel, LogNotice, "Page study: pattern %s, %u samples per size, up to %u bytes",
+                 cPattern, samplesPerSize, maxBytes);
+
+  const auto latencies = m_Arena.Allocate<u64>(samplesPerSize);
+  if (latencies == nullptr) return ArenaExhausted("page study latencies", samplesPerSize * sizeof(u64));
+
+  COutputFile file;
+  FRESULT Result = file.Open(fileName, 4096);
+  if (Result != FR_OK) {
+    m_Logger.Write(FromKernel, LogPanic, "Cannot create file: %s (%d)", cFileName, Result);
+    return FailedTotally;
+  }
+  file.Write("bytes,samples,failed,mean_latency_milli,median_latency,shannon_mbit,min_entropy_mbit,"
+             "lsb_ones_permille,us_per_sample,min_entropy_bits_per_s\n");
+
+  u8 first[MEM_PAGE_SIZE];
+  u8 second[MEM_PAGE_SIZE];
+  CString Msg;
+
+  for (unsigned bytes = 1; bytes <= maxBytes; bytes *= 2) {
+    unsigned valid = 0;
+    const u64 start = CTimer::GetClockTicks64();
+    for (unsigned i = 0; i < samplesPerSize; ++i) {
+      // Stay within a single page
+      const u32 page = genrand_range(0, MEM_SIZE_ADR / MEM_PAGE_SIZE);
+      const u32 addr = page * MEM_PAGE_SIZE + genrand_range(0, MEM_PAGE_SIZE - bytes + 1);
+      FillPagePattern(pattern, first, second, bytes);
+
+      u64 latency;
+      if (MemWritePageAndPoll(latency, addr, first, bytes) != Okay) continue;
+      if (MemWritePageAndPoll(latency, addr, second, bytes) != Okay) continue;
+      latencies[valid++] = latency;
+    }
+    const u64 elapsed = CTimer::GetClockTicks64() - start;
+
+    TLatencyStatistics stats;
+    ComputeStatistics(stats, latencies, valid);
+    const u64 usPerSample = elapsed / samplesPerSize;
+    const u64 bitsPerSecond = elapsed ? static_cast<u64>(stats.MinEntropy * valid * 1000000.0 / elapsed) : 0;
+
+    Msg.Format("%u,%u,%u,%llu,%llu,%u,%u,%u,%llu,%llu\n", bytes, samplesPerSize, samplesPerSize - valid,
+               static_cast<u64>(stats.Mean * 1000), stats.Median,
+               static_cast<unsigned>(stats.ShannonEntropy * 1000), static_cast<unsigned>(stats.MinEntropy * 1000),
+               static_cast<unsigned>(stats.LSBOnes * 1000), usPerSample, bitsPerSecond);
+    Result = file.Write(Msg);
+    if (Result != FR_OK) {
+      m_Logger.Write(FromKernel, LogError, "Write error (%d)", Result);
+      result = FailedPartially;
+      break;
+    }
+    m_Logger.Write(FromKernel, LogNotice, "%u bytes: %u mbit min-entropy per write, %llu µs per sample",
+                   bytes, static_cast<unsigned>(stats.MinEntropy * 1000), usPerSample);
+  }
+
+  Result = file.Close();
+  if (Result == FR_OK) {
+    m_Logger.Write(FromKernel, LogNotice, "Successfully written page study to %s!", cFileName);
+  } else {
+    m_Logger.Write(FromKernel, LogPanic, "Cannot close page study file (%d)", Result);
+    result = FailedPartially;
+  }
+
+  return result;
+}
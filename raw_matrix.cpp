@@ -0,0 +1,231 @@
+//
+// raw_matrix.cpp
+//
+#include "kernel.h"
+
+#include "output_file.h"
+
+#define DRIVE        "SD:"
+
+static_assert(BURNOUT_MAX_CELLS >= RAW_MAX_SWEEPS * RAW_MAX_CELLS, "Burnt cells must fit into one campaign");
+
+// Byte pairs of the short sweeps
+static constexpr u8 s_Num1s[] = {0x00, 0xff, 0xaa, 0x55, 0x73, 0xfc, 0xc5, 0x1c, 0x9d, 0x4c};
+static constexpr u8 s_Num2s[] = {0xff, 0x00, 0x55, 0xaa, 0x73, 0x36, 0x29, 0x9f, 0x1b, 0xd8};
+
+struct TRawSweepDefaults {
+  char Type;
+  const char* Name;
+  const char* Cells;
+  bool FullMatrix;
+  unsigned Tries;
+};
+
+// In the order they are measured and written
+static const TRawSweepDefaults s_RawSweeps[RAW_MAX_SWEEPS] = {
+  {'B', "burnt1", "1,9022,26978,44054,60772", false, 20},
+  {'S', "sane1", "3609,17625,29463,48071,58244", false, 20},
+  {'B', "burnt2", "6,10990,31987,54833,64198", true, 8},
+  {'S', "sane2", "7541,24251,36203,49382,60456", true, 8}
+};
+
+unsigned CKernel::LoadRawSweeps(TRawSweep* sweeps) {
+  unsigned count = 0;
+  for (const auto& defaults : s_RawSweeps) {
+#if !MEM_CAN_BURN_OUT
+    if (defaults.Type == 'B') continue;
+#endif
+    TRawSweep& sweep = sweeps[count++];
+    sweep.Type = defaults.Type;
+    sweep.Name = defaults.Name;
+    sweep.Tries = defaults.Tries;
+
+    CString key;
+    key.Format("raw_%s", defaults.Name);
+    const char* cKey = key;
+    unsigned cells[RAW_MAX_CELLS];
+    const unsigned cellCount = ParseNumberList(GetParamString(cKey, defaults.Cells), cells, RAW_MAX_CELLS);
+    sweep.CellCount = 0;
+    for (unsigned i = 0; i < cellCount; ++i) {
+      if (cells[i] >= MEM_SIZE_ADR) {
+        m_Logger.Write(FromKernel, LogWarning, "%s: cell %u does not exist, skipping it", cKey, cells[i]);
+        continue;
+      }
+      sweep.Cells[sweep.CellCount++] = cells[i];
+    }
+
+    if (defaults.FullMatrix) {
+      sweep.PairCount = RAW_FULL_PAIRS;
+    } else {
+      sweep.PairCount = sizeof(s_Num1s) / sizeof(u8);
+      for (unsigned i = 0; i < sweep.PairCount; ++i) {
+        sweep.Num1s[i] = s_Num1s[i];
+        sweep.Num2s[i] = s_Num2s[i];
+      }
+    }
+  }
+  return count;
+}
+
+// Appends ",<name>=<type>/<cell;...>/<all|num1:num2;...>/<tries>"
+static void AppendSweep(CString& header, const TRawSweep& sweep) {
+  CString part;
+  part.Format(",%s=%c/", sweep.Name, sweep.Type);
+  header.Append(part);
+  for (unsigned i = 0; i < sweep.CellCount; ++i) {
+    part.Format(i == 0 ? "%u" : ";%u", sweep.Cells[i]);
+    header.Append(part);
+  }
+  if (sweep.PairCount == RAW_FULL_PAIRS) {
+    header.Append("/all");
+  } else {
+    for (unsigned i = 0; i < sweep.PairCount; ++i) {
+      part.Format(i == 0 ? "/%u:%u" : ";%u:%u", sweep.Num1s[i], sweep.Num2s[i]);
+      header.Append(part);
+    }
+  }
+  part.Format("/%u", sweep.Tries);
+  header.Append(part);
+}
+
+MeasurementResult CKernel::WriteLatencyRngTest2() {
+  MeasurementResult result = Okay;
+
+#define FILENAME MEM_NAME_SIMPLE "_%d_measure.log"
+  const CString fileName = GetFreeFile(DRIVE FILENAME);
+  const char* cFileName = fileName;
+  m_Logger.Write(FromKernel, LogNotice, "Choosing bits file %s", cFileName);
+
+  // Boards with shard_index 0 .. shard_count - 1 measure disjoint parts of every sweep (see tools/merge_shards)
+  unsigned shardCount = GetParamNumber("shard_count", 1);
+  if (shardCount == 0) shardCount = 1;
+  const unsigned shardIndex = GetParamNumber("shard_index", 0);
+  if (shardIndex >= shardCount) {
+    m_Logger.Write(FromKernel, LogError, "shard_index %u is not below shard_count %u", shardIndex, shardCount);
+    return FailedTotally;
+  }
+
+  TRawSweep sweeps[RAW_MAX_SWEEPS];
+  const unsigned sweepCount = LoadRawSweeps(sweeps);
+
+  // Part of a sweep measured by this board
+  struct TRawShard {
+    u32 First;
+    u32 Count;
+    u64* Times;
+    u64* FirstTimes;
+    u8 Initial[RAW_MAX_CELLS]; // Cell content before the first sample
+  } shards[RAW_MAX_SWEEPS];
+
+  // All buffers are taken before any cell is burnt out
+  size_t samples = 0;
+  for (unsigned s = 0; s < sweepCount; ++s) {
+    TRawShard& shard = shards[s];
+    sweeps[s].GetShard(shardIndex, shardCount, shard.First, shard.Count);
+    const size_t count = static_cast<size_t>(shard.Count) * sweeps[s].Tries;
+    shard.Times = m_Arena.Allocate<u64>(count);
+    shard.FirstTimes = m_Arena.Allocate<u64>(count);
+    if (shard.Times == nullptr || shard.FirstTimes == nullptr) {
+      return ArenaExhausted("raw latencies", count * 2 * sizeof(u64));
+    }
+    samples += count;
+    m_Logger.Write(FromKernel, LogNotice, "%s: combinations %u to %u of %u (shard %u of %u)", sweeps[s].Name,
+                   shard.First, shard.First + shard.Count, sweeps[s].GetCombinations(), shardIndex + 1, shardCount);
+  }
+
+#if MEM_CAN_BURN_OUT
+  u32 burntCells[BURNOUT_MAX_CELLS];
+  unsigned burntCount = 0;
+  for (unsigned s = 0; s < sweepCount; ++s) {
+    const TRawSweep& sweep = sweeps[s];
+    const TRawShard& shard = shards[s];
+    if (sweep.Type != 'B' || shard.Count == 0) continue;
+    // Only the cells this board measures
+    for (u32 c = shard.First / sweep.PairCount; c <= (shard.First + shard.Count - 1) / sweep.PairCount; ++c) {
+      burntCells[burntCount++] = sweep.Cells[c];
+    }
+  }
+  result = BurnOutCampaign(burntCells, burntCount);
+  if (result != Okay) return result;
+#endif
+
+  // The first write of every sample overwrites the previous one (or the initial content of the cell)
+  u64 latency, firstLatency;
+  for (unsigned s = 0; s < sweepCount; ++s) {
+    const TRawSweep& sweep = sweeps[s];
+    TRawShard& shard = shards[s];
+    unsigned idx = 0;
+    for (u32 i = shard.First; i < shard.First + shard.Count; ++i) {
+      const u32 addr = sweep.GetCell(i);
+      if (i == shard.First || i % sweep.PairCount == 0) shard.Initial[i / sweep.PairCount] = MemRead(addr);
+      const u8 num1 = sweep.GetNum1(i);
+      const u8 num2 = sweep.GetNum2(i);
+      for (unsigned k = 0; k < sweep.Tries; ++k) {
+        RandomWriteLatency(firstLatency, latency, addr, num1, num2);
+        shard.FirstTimes[idx] = firstLatency;
+        shard.Times[idx++] = latency;
+      }
+    }
+    m_Logger.Write(FromKernel, LogNotice, "%s done", sweep.Name);
+  }
+
+  COutputFile file;
+  // Rows are about 30 bytes long
+  FRESULT Result = file.Open(fileName, 1024 + static_cast<FSIZE_t>(samples) * 30);
+  if (Result != FR_OK) {
+    m_Logger.Write(FromKernel, LogPanic, "Cannot create file: %s (%d)", cFileName, Result);
+    return FailedTotally;
+  }
+
+  const u64 serial = GetBoardSerial();
+  CString header;
+  header.Format(RAW_HEADER ",version=%u,shard=%u/%u,board=%08x%08x,mem=%s,mem_type=%u,"
+                "spi_freq_wren=%u,spi_freq_write=%u,spi_freq_poll=%u,spi_freq_read=%u,spi_async=%u",
+                RAW_VERSION, shardIndex, shardCount, static_cast<u32>(serial >> 32), static_cast<u32>(serial),
+                MEM_NAME_SIMPLE, MEM_TYPE, m_SPIClocks.WriteEnable, m_SPIClocks.Write, m_SPIClocks.Poll,
+                m_SPIClocks.Read, SPI_ASYNC_BUILD);
+  for (unsigned s = 0; s < sweepCount; ++s) AppendSweep(header, sweeps[s]);
+  header.Append("\n");
+  file.Write(header);
+
+  char row[MEASUREMENT_ROW_MAX];
+  for (unsigned s = 0; s < sweepCount && Result == FR_OK; ++s) {
+    const TRawSweep& sweep = sweeps[s];
+    const TRawShard& shard = shards[s];
+    unsigned idx = 0;
+    u8 prev = 0;
+    for (u32 i = shard.First; i < shard.First + shard.Count && Result == FR_OK; ++i) {
+      if (i == shard.First || i % sweep.PairCount == 0) prev = shard.Initial[i / sweep.PairCount];
+      const u32 addr = sweep.GetCell(i);
+      const u8 num1 = sweep.GetNum1(i);
+      const u8 num2 = sweep.GetNum2(i);
+      for (unsigned k = 0; k < sweep.Tries; ++k) {
+        const unsigned length = FormatMeasurementRow(row, sweep.Type, addr, num1, num2, shard.Times[idx],
+                                                     prev, shard.FirstTimes[idx]);
+        prev = num2;
+        ++idx;
+        Result = file.Write(row, length);
+        if (Result != FR_OK) {
+          m_Logger.Write(FromKernel, LogError, "Write error (%d)", Result);
+          result = FailedPartially;
+          break;
+        }
+      }
+    }
+    m_Logger.Write(FromKernel, LogNotice, "%s written", sweep.Name);
+  }
+
+  CString trailer;
+  trailer.Format(RAW_TRAILER ",rows=%u\n", static_cast<unsigned>(samples));
+  file.Write(trailer);
+
+  Result = file.Close();
+  if (Result == FR_OK) {
+    m_Logger.Write(FromKernel, LogNotice, "Successfully written bits to %s!", cFileName);
+  } else {
+    m_Logger.Write(FromKernel, LogPanic, "Cannot close bits file (%d)", Result);
+    result = FailedPartially;
+  }
+
+  return result;
+}
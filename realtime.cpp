@@ -0,0 +1,216 @@
+//
+// realtime.cpp
+//
+#include "kernel.h"
+
+#include "mt19937ar.h"
+#include "output_file.h"
+#include "trace_format.h"
+
+#include <circle/new.h>
+
+#define DRIVE        "SD:"
+
+#define RT_STALL_SLACK_US  10   // Added to the expected time between two polls
+#define RT_WRITE_CHUNK     1024 // Samples per write to the output file
+#define RT_DEBUG_STEPS     100000
+#define RT_POP_TIMEOUT_US  1000000 // Far longer than a failed measurement (1000 polls) takes
+
+void CKernel::RealtimeSampling() {
+#if SAMPLER_CORE
+  // Neither IRQs nor FIQs may interrupt a measurement on this core
+  EnterCritical(FIQ_LEVEL);
+
+  u32 addr = 0;
+  unsigned remaining = 0;
+  while (!m_SamplerCore.IsStopRequested()) {
+    u64 cycles;
+    unsigned maxGap;
+    if (remaining == 0) {
+      // Same chain as ChainedWriteLatency(u64&, int)
+      addr = SelectRandomAddress();
+      MemWrite(addr, genrand_range(0, 256));
+      if (WIPPollingCyclesTimed(cycles, maxGap, 1000) != Okay) {
+        // Recorded like any other failed measurement, so the consumer never waits in vain
+        m_pLatencyRing->Push(LATENCY_RING_FAILED);
+        continue;
+      }
+      remaining = m_nChainLength - 1;
+    }
+
+    --remaining;
+    MemWrite(addr, genrand_range(0, 256));
+    u32 entry;
+    if (WIPPollingCyclesTimed(cycles, maxGap, 1000) == Okay) {
+      entry = EncodeTraceSample(cycles);
+    } else {
+      entry = LATENCY_RING_FAILED;
+      remaining = 0;
+    }
+    if (maxGap > m_nStallThreshold) entry |= LATENCY_RING_STALLED;
+    m_pLatencyRing->Push(entry);
+  }
+
+  LeaveCritical();
+#endif
+}
+
+MeasurementResult CKernel::RealtimeMode() {
+#if !SAMPLER_CORE
+  m_Logger.Write(FromKernel, LogError, "Real-time mode needs the multi-core build and synchronous SPI");
+  return FailedTotally;
+#else
+  MeasurementResult result = Okay;
+
+  // One index for the trace and its debug file
+#define FILENAME_RT MEM_NAME_SIMPLE "_%d_rt.bin"
+#define FILENAME_RT_DEBUG MEM_NAME_SIMPLE "_%d_rt.log"
+  const char* patterns[] = {DRIVE FILENAME_RT, DRIVE FILENAME_RT_DEBUG};
+  const int index = GetFreeIndex(patterns, sizeof(patterns) / sizeof(patterns[0]));
+  CString fileName, fileNameDebug;
+  fileName.Format(patterns[0], index);
+  fileNameDebug.Format(patterns[1], index);
+  const char* cFileName = fileName;
+  const char* cFileNameDebug = fileNameDebug;
+  m_Logger.Write(FromKernel, LogNotice, "Choosing real-time trace file %s", cFileName);
+
+  const unsigned totalSamples = GetParamNumber("rt_samples", 1000000);
+  // One RDSR transfer takes 16 clock cycles
+  const unsigned pollUs = (16 * 1000000 + m_SPIClocks.Poll - 1) / m_SPIClocks.Poll;
+  m_nStallThreshold = GetParamNumber("rt_stall_us", 2 * pollUs + RT_STALL_SLACK_US);
+  const bool keepStalled = GetParamNumber("rt_keep_stalled", 0) != 0;
+  m_Logger.Write(FromKernel, LogNotice, "Real-time sampling: %u samples, stalled if a poll takes more than %u µs",
+                 totalSamples, m_nStallThreshold);
+
+  const TTraceHeader header = {
+    {TRACE_MAGIC[0], TRACE_MAGIC[1], TRACE_MAGIC[2], TRACE_MAGIC[3]},
+    TRACE_VERSION,
+    sizeof(u16),
+    MEM_TYPE,
+    m_SPIClocks.Poll,
+    totalSamples,
+    SPI_ASYNC_BUILD ? TRACE_FLAG_SPI_ASYNC : 0u,
+    0
+  };
+
+  void* pRing = m_Arena.Allocate<CLatencyRing>(1);
+  if (pRing == nullptr) return ArenaExhausted("latency ring", sizeof(CLatencyRing));
+  m_pLatencyRing = new (pRing) CLatencyRing;
+
+  COutputFile file;
+  FRESULT Result = file.Open(fileName, sizeof(header) + static_cast<FSIZE_t>(totalSamples) * sizeof(u16));
+  if (Result != FR_OK) {
+    m_Logger.Write(FromKernel, LogPanic, "Cannot create file: %s (%d)", cFileName, Result);
+    m_pLatencyRing = nullptr;
+    return FailedTotally;
+  }
+  Result = file.Write(&header, sizeof(header));
+  if (Result != FR_OK) {
+    m_Logger.Write(FromKernel, LogPanic, "Cannot write file: %s (%d)", cFileName, Result);
+    file.Close();
+    m_pLatencyRing = nullptr;
+    return FailedTotally;
+  }
+
+  m_HealthTests.Reset();
+
+  u16 chunk[RT_WRITE_CHUNK];
+  unsigned chunkLength = 0;
+  unsigned stalled = 0, failed = 0;
+  const u64 start = CTimer::GetClockTicks64();
+  if (!m_SamplerCore.Start(SamplerTaskRealtime)) {
+    m_Logger.Write(FromKernel, LogError, "Sampler core is still busy with another task");
+    file.Close();
+    m_pLatencyRing = nullptr;
+    return FailedTotally;
+  }
+  u32 drops = 0;
+  for (unsigned i = 0; i < totalSamples; ++i) {
+    u32 entry = LATENCY_RING_DROPPED;
+    if (drops > 0) {
+      // Every dropped sample keeps its place in the trace as an invalid one
+      --drops;
+    } else {
+      const u64 waitStart = CTimer::GetClockTicks64();
+      bool popped;
+      while (!(popped = m_pLatencyRing->Pop(entry)) && CTimer::GetClockTicks64() - waitStart <= RT_POP_TIMEOUT_US) {}
+      if (!popped) {
+        m_Logger.Write(FromKernel, LogError, "Sampler core stopped delivering after %u samples", i);
+        result = FailedTotally;
+        break;
+      }
+      if (entry & LATENCY_RING_DROPPED) {
+        drops = (entry & LATENCY_RING_DROPS) - 1;
+      }
+    }
+
+    u16 sample = static_cast<u16>(entry & LATENCY_RING_LATENCY);
+    if (entry & LATENCY_RING_DROPPED) {
+      sample = TRACE_INVALID_SAMPLE;
+    } else if (entry & LATENCY_RING_FAILED) {
+      sample = TRACE_INVALID_SAMPLE;
+      ++failed;
+    } else if (entry & LATENCY_RING_STALLED) {
+      if (!keepStalled) sample = TRACE_INVALID_SAMPLE;
+      ++stalled;
+    }
+    if (sample != TRACE_INVALID_SAMPLE) m_HealthTests.Feed(sample);
+
+    chunk[chunkLength++] = sample;
+    if (chunkLength == RT_WRITE_CHUNK) {
+      Result = file.Write(chunk, sizeof(chunk));
+      chunkLength = 0;
+      if (Result != FR_OK) {
+        m_Logger.Write(FromKernel, LogError, "Write error after %u samples (%d)", i + 1, Result);
+        result = FailedTotally;
+        break;
+      }
+    }
+    if ((i + 1) % RT_DEBUG_STEPS == 0) {
+      m_Logger.Write(FromKernel, LogNotice, "%u samples, %llu µs, %u stalled, %u m°C", i + 1,
+                     CTimer::GetClockTicks64() - start, stalled, GetTemperature());
+    }
+  }
+  m_SamplerCore.Stop();
+  const u64 elapsed = CTimer::GetClockTicks64() - start;
+
+  Result = file.Write(chunk, chunkLength * sizeof(u16));
+  if (Result != FR_OK) {
+    m_Logger.Write(FromKernel, LogError, "Write error (%d)", Result);
+    result = FailedTotally;
+  }
+  Result = file.Close();
+  if (Result == FR_OK && result == Okay) {
+    m_Logger.Write(FromKernel, LogNotice, "Successfully written real-time trace to %s!", cFileName);
+  } else if (Result == FR_OK) {
+    m_Logger.Write(FromKernel, LogError, "Real-time trace %s is incomplete", cFileName);
+  } else {
+    m_Logger.Write(FromKernel, LogPanic, "Cannot write real-time trace file (%d)", Result);
+    result = FailedTotally;
+  }
+
+  const unsigned dropped = m_pLatencyRing->GetDropped();
+  m_pLatencyRing = nullptr;
+
+  CString Msg;
+  Msg.Format("Time needed: %llu µs\nSamples: %u (%llu per second)\nStalled: %u\nFailed: %u\n"
+             "Dropped (ring full, recorded as invalid): %u\nHealth test failures: RCT %u, APT %u\n",
+             elapsed, totalSamples, elapsed ? static_cast<u64>(totalSamples) * 1000000 / elapsed : 0,
+             stalled, failed, dropped,
+             m_HealthTests.GetRepetitionFailures(), m_HealthTests.GetProportionFailures());
+  const char* cMsg = Msg;
+  m_Logger.Write(FromKernel, LogNotice, "%s", cMsg);
+
+  Result = file.Open(fileNameDebug);
+  if (Result == FR_OK) Result = file.Write(Msg);
+  if (Result == FR_OK) Result = file.Close();
+  if (Result == FR_OK) {
+    m_Logger.Write(FromKernel, LogNotice, "Successfully written debug data to %s!", cFileNameDebug);
+  } else {
+    m_Logger.Write(FromKernel, LogPanic, "Cannot write debug data file %s (%d)", cFileNameDebug, Result);
+    if (result == Okay) result = FailedPartially;
+  }
+
+  return result;
+#endif
+}
@@ -0,0 +1,71 @@
+//
+// sampler_core.cpp
+//
+#include "sampler_core.h"
+
+#if SAMPLER_CORE
+
+#include "kernel.h"
+
+#include <circle/synchronize.h>
+
+CSamplerCore::CSamplerCore(CKernel* pKernel)
+  : CMultiCoreSupport(CMemorySystem::Get()),
+    m_pKernel(pKernel),
+    m_Task(SamplerTaskNone),
+    m_bStop(false),
+    m_bRunning(false) {}
+
+CSamplerCore::~CSamplerCore() = default;
+
+bool CSamplerCore::Start(const TSamplerTask task) {
+  if (m_bRunning) return false;
+
+  m_bStop = false;
+  m_bRunning = true;
+  DataMemBarrier();
+  m_Task = task;
+  return true;
+}
+
+void CSamplerCore::Stop() {
+  m_bStop = true;
+  DataMemBarrier();
+  while (m_bRunning) {}
+  DataMemBarrier();
+}
+
+bool CSamplerCore::IsStopRequested() const {
+  return m_bStop;
+}
+
+bool CSamplerCore::IsRunning() const {
+  return m_bRunning;
+}
+
+void CSamplerCore::Run(const unsigned nCore) {
+  // The other secondary cores are not needed
+  if (nCore != SAMPLER_CORE_NUMBER) return;
+
+  for (;;) {
+    while (m_Task == SamplerTaskNone) {}
+    DataMemBarrier();
+
+    switch (m_Task) {
+    case SamplerTaskFastStart:
+      m_pKernel->FastStartSampling();
+      break;
+    case SamplerTaskRealtime:
+      m_pKernel->RealtimeSampling();
+      break;
+    default:
+      break;
+    }
+
+    m_Task = SamplerTaskNone;
+    DataMemBarrier();
+    m_bRunning = false;
+  }
+}
+
+#endif
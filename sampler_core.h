@@ -0,0 +1,59 @@
+#pragma once
+
+#include <circle/multicore.h>
+#include <circle/types.h>
+
+// Sampling on a secondary core needs the multi-core build of circle (see init.sh)
+// and the polling SPI master, as DMA completions are only delivered to core 0
+#if defined(ARM_ALLOW_MULTI_CORE) && !SPI_ASYNC
+#define SAMPLER_CORE 1
+#else
+#define SAMPLER_CORE 0
+#endif
+
+#if SAMPLER_CORE
+
+#define SAMPLER_CORE_NUMBER    1
+
+class CKernel;
+
+enum TSamplerTask {
+  SamplerTaskNone,
+  // CKernel::FastStartSampling()
+  SamplerTaskFastStart,
+  // CKernel::RealtimeSampling()
+  SamplerTaskRealtime
+};
+
+/**
+ * Runs sampling tasks of the kernel on core 1 while core 0 does everything else.
+ * Only one task runs at a time; core 0 must not access the SPI memory while it does.
+ */
+class CSamplerCore : public CMultiCoreSupport {
+public:
+  explicit CSamplerCore(CKernel* pKernel);
+
+  ~CSamplerCore() override;
+
+  // Returns false if another task is still running
+  bool Start(TSamplerTask task);
+
+  // Asks the running task to finish and waits until it has
+  void Stop();
+
+  // Polled by the tasks
+  bool IsStopRequested() const;
+
+  bool IsRunning() const;
+
+  void Run(unsigned nCore) override;
+
+private:
+  CKernel* m_pKernel;
+
+  volatile TSamplerTask m_Task;
+  volatile bool m_bStop;
+  volatile bool m_bRunning;
+};
+
+#endif
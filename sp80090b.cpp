@@ -0,0 +1,161 @@
+//
+// sp80090b.cpp
+//
+#include "kernel.h"
+
+#include "mt19937ar.h"
+#include "output_file.h"
+
+#define DRIVE        "SD:"
+
+#define SP80090B_DEBUG_STEPS  100000
+
+// Default seed of mt19937ar.cpp, which the kernel never reseeds
+#define SP80090B_BOOT_SEED    5489
+
+void CKernel::RestartSampler() {
+  // Everything a reboot would start from: address and value sequence, chain, quantiser and health tests
+  init_genrand(SP80090B_BOOT_SEED);
+  m_nChainRemaining = 0;
+  m_Baseline.Reset();
+  m_HealthTests.Reset();
+}
+
+MeasurementResult CKernel::AcquireRawSamples(u8* samples, const unsigned count, const u8 mask, unsigned& failed) {
+  unsigned retries = 0;
+  for (unsigned i = 0; i < count;) {
+    u64 latency;
+    if (ChainedWriteLatency(latency, 1000) != Okay) {
+      // Failed measurements are retried, as the datasets must be contiguous; give up if the memory stopped answering
+      ++failed;
+      if (++retries > count) return FailedTotally;
+      continue;
+    }
+    m_HealthTests.Feed(latency);
+    samples[i++] = static_cast<u8>(latency & mask);
+  }
+  return Okay;
+}
+
+static FRESULT WriteDataset(const char* pFileName, const u8* samples, const unsigned count) {
+  COutputFile file;
+  FRESULT Result = file.Open(pFileName, count);
+  if (Result == FR_OK) Result = file.Write(samples, count);
+  const FRESULT CloseResult = file.Close();
+  return Result != FR_OK ? Result : CloseResult;
+}
+
+MeasurementResult CKernel::SP80090BMode() {
+  MeasurementResult result = Okay;
+
+  // One index for the three files of a run
+#define FILENAME_SP_SEQUENTIAL MEM_NAME_SIMPLE "_%d_sp80090b_seq.bin"
+#define FILENAME_SP_RESTART MEM_NAME_SIMPLE "_%d_sp80090b_restart.bin"
+#define FILENAME_SP_DEBUG MEM_NAME_SIMPLE "_%d_sp80090b.log"
+  const char* patterns[] = {DRIVE FILENAME_SP_SEQUENTIAL, DRIVE FILENAME_SP_RESTART, DRIVE FILENAME_SP_DEBUG};
+  const int index = GetFreeIndex(patterns, sizeof(patterns) / sizeof(patterns[0]));
+  CString fileNameSequential, fileNameRestart, fileNameDebug;
+  fileNameSequential.Format(patterns[0], index);
+  fileNameRestart.Format(patterns[1], index);
+  fileNameDebug.Format(patterns[2], index);
+  const char* cFileNameSequential = fileNameSequential;
+  const char* cFileNameRestart = fileNameRestart;
+  const char* cFileNameDebug = fileNameDebug;
+  m_Logger.Write(FromKernel, LogNotice, "Choosing SP 800-90B files %s and %s", cFileNameSequential, cFileNameRestart);
+
+  // One sample per byte, as ea_non_iid and ea_restart expect
+  unsigned bits = GetParamNumber("sp80090b_bits", 8);
+  if (bits < 1 || bits > 8) bits = 8;
+  const u8 mask = static_cast<u8>((1u << bits) - 1);
+  const unsigned sequentialSamples = GetParamNumber("sp80090b_samples", 1000000);
+  const unsigned restarts = GetParamNumber("sp80090b_restarts", 1000);
+  const unsigned restartSamples = GetParamNumber("sp80090b_restart_samples", 1000);
+  m_Logger.Write(FromKernel, LogNotice, "SP 800-90B: %u bits per sample, %u sequential samples, "
+                 "%u × %u restart matrix", bits, sequentialSamples, restarts, restartSamples);
+
+  // Both datasets are kept in memory, so the SD card is quiet while sampling and each file is one sequential write
+  if (restartSamples != 0 && restarts > 0xFFFFFFFFu / restartSamples) {
+    m_Logger.Write(FromKernel, LogError, "Restart matrix of %u × %u samples is too large", restarts, restartSamples);
+    return FailedTotally;
+  }
+  const unsigned restartTotal = restarts * restartSamples;
+  const unsigned bufferSize = sequentialSamples > restartTotal ? sequentialSamples : restartTotal;
+  const auto samples = m_Arena.Allocate<u8>(bufferSize);
+  if (samples == nullptr) return ArenaExhausted("SP 800-90B samples", bufferSize);
+
+  // Sequential dataset: the first samples after boot (or after the previous job)
+  unsigned failedSequential = 0;
+  RestartSampler();
+  u64 start = CTimer::GetClockTicks64();
+  for (unsigned i = 0; i < sequentialSamples && result == Okay; i += SP80090B_DEBUG_STEPS) {
+    const unsigned count = sequentialSamples - i < SP80090B_DEBUG_STEPS ? sequentialSamples - i : SP80090B_DEBUG_STEPS;
+    result = AcquireRawSamples(samples + i, count, mask, failedSequential);
+    m_Logger.Write(FromKernel, LogNotice, "%u samples, %llu µs", i + count, CTimer::GetClockTicks64() - start);
+  }
+  const u64 sequentialTime = CTimer::GetClockTicks64() - start;
+  const unsigned rctSequential = m_HealthTests.GetRepetitionFailures();
+  const unsigned aptSequential = m_HealthTests.GetProportionFailures();
+  if (result != Okay) {
+    m_Logger.Write(FromKernel, LogError, "SPI memory does not respond (%u failed measurements)", failedSequential);
+    return result;
+  }
+
+  FRESULT Result = WriteDataset(fileNameSequential, samples, sequentialSamples);
+  if (Result == FR_OK) {
+    m_Logger.Write(FromKernel, LogNotice, "Successfully written sequential dataset to %s!", cFileNameSequential);
+  } else {
+    m_Logger.Write(FromKernel, LogPanic, "Cannot write sequential dataset %s (%d)", cFileNameSequential, Result);
+    return FailedTotally;
+  }
+
+  // Restart dataset: row r holds the first samples after restart r
+  unsigned failedRestart = 0, rctRestart = 0, aptRestart = 0;
+  start = CTimer::GetClockTicks64();
+  for (unsigned r = 0; r < restarts && result == Okay; ++r) {
+    RestartSampler();
+    result = AcquireRawSamples(samples + r * restartSamples, restartSamples, mask, failedRestart);
+    rctRestart += m_HealthTests.GetRepetitionFailures();
+    aptRestart += m_HealthTests.GetProportionFailures();
+    if ((r + 1) % 100 == 0) {
+      m_Logger.Write(FromKernel, LogNotice, "%u restarts, %llu µs", r + 1, CTimer::GetClockTicks64() - start);
+    }
+  }
+  const u64 restartTime = CTimer::GetClockTicks64() - start;
+
+  if (result == Okay) {
+    Result = WriteDataset(fileNameRestart, samples, restartTotal);
+    if (Result == FR_OK) {
+      m_Logger.Write(FromKernel, LogNotice, "Successfully written restart dataset to %s!", cFileNameRestart);
+    } else {
+      m_Logger.Write(FromKernel, LogPanic, "Cannot write restart dataset %s (%d)", cFileNameRestart, Result);
+      result = FailedPartially;
+    }
+  } else {
+    m_Logger.Write(FromKernel, LogError, "Restart dataset incomplete (%u failed measurements)", failedRestart);
+    result = FailedPartially;
+  }
+  CString Msg;
+  Msg.Format("Bits per sample: %u\nSPI clocks: WREN %u Hz, WR %u Hz, RDSR %u Hz\nChain length: %u\n"
+             "Sequential: %u samples, %llu µs, %u failed, RCT %u, APT %u\n"
+             "Restart: %u × %u samples, %llu µs, %u failed, RCT %u, APT %u\n"
+             "Assessment:\n  ea_non_iid -v %s %u\n  ea_restart -v %s %u <H_I>\n",
+             bits, m_SPIClocks.WriteEnable, m_SPIClocks.Write, m_SPIClocks.Poll, m_nChainLength,
+             sequentialSamples, sequentialTime, failedSequential, rctSequential, aptSequential,
+             restarts, restartSamples, restartTime, failedRestart, rctRestart, aptRestart,
+             cFileNameSequential, bits, cFileNameRestart, bits);
+  const char* cMsg = Msg;
+  m_Logger.Write(FromKernel, LogNotice, "%s", cMsg);
+
+  COutputFile file;
+  Result = file.Open(fileNameDebug);
+  if (Result == FR_OK) Result = file.Write(Msg);
+  if (Result == FR_OK) Result = file.Close();
+  if (Result == FR_OK) {
+    m_Logger.Write(FromKernel, LogNotice, "Successfully written debug data to %s!", cFileNameDebug);
+  } else {
+    m_Logger.Write(FromKernel, LogPanic, "Cannot write debug data file %s (%d)", cFileNameDebug, Result);
+    if (result == Okay) result = FailedPartially;
+  }
+
+  return result;
+}
@@ -1,6 +1,51 @@
 #include "kernel.h"
 #include "spi_memory.h"
 
+#include "mt19937ar.h"
+
+// Encodes instruction and address; returns the number of bytes written to data
+static unsigned EncodeAddress(u8* data, const u8 instruction, const u32 adr) {
+  data[0] = instruction;
+#if MEM_ADR_SEND == 2
+  data[1] = static_cast<u8>(adr >> 8 & 0xFF);
+  data[2] = static_cast<u8>(adr >> 0 & 0xFF);
+#elif MEM_ADR_SEND == 3
+  data[1] = static_cast<u8>(adr >> 16 & 0xFF);
+  data[2] = static_cast<u8>(adr >> 8 & 0xFF);
+  data[3] = static_cast<u8>(adr >> 0 & 0xFF);
+#endif
+  return 1 + MEM_ADR_SEND;
+}
+
+int CKernel::SPIWrite(const void* data, const unsigned len, const unsigned clock) {
+#if SPI_ASYNC
+  DiscardPendingPair();
+  return m_SPIQueue.Transfer(data, nullptr, len, clock);
+#else
+  SetSPIClock(clock);
+  return m_SPIMaster.Write(SPI_CHIP_SELECT, data, len);
+#endif
+}
+
+int CKernel::SPIWriteRead(const void* data, void* reg, const unsigned len, const unsigned clock) {
+#if SPI_ASYNC
+  DiscardPendingPair();
+  return m_SPIQueue.Transfer(data, reg, len, clock);
+#else
+  SetSPIClock(clock);
+  return m_SPIMaster.WriteRead(SPI_CHIP_SELECT, data, reg, len);
+#endif
+}
+
+#if !SPI_ASYNC
+void CKernel::SetSPIClock(const unsigned clock) {
+  // Reprogramming the divider costs a register write, so skip it if nothing changes
+  if (clock == m_nSPIClock) return;
+  m_SPIMaster.SetClock(clock);
+  m_nSPIClock = clock;
+}
+#endif
+
 void CKernel::SetWriteEnable() {
   m_WEPin.Write(LOW);
 }
@@ -9,22 +54,11 @@ void CKernel::ResetWriteEnable() {
   m_WEPin.Write(HIGH);
 }
 
-MemoryStatusRegister CKernel::ParseStatusRegister(const u8 statusRegister) {
-  return (MemoryStatusRegister){
-    static_cast<u8>((statusRegister & 0b10000000) >> 7),
-    static_cast<u8>((statusRegister & 0b01000000) >> 6),
-    static_cast<u8>((statusRegister & 0b00100000) >> 5),
-    static_cast<u8>((statusRegister & 0b00001100) >> 2),
-    static_cast<u8>((statusRegister & 0b00000010) >> 1),
-    static_cast<u8>((statusRegister & 0b00000001))
-  };
-}
-
 void CKernel::ReadStatusRegister(MemoryStatusRegister* statusRegister) {
   constexpr u8 data[] = {ReRAM_RDSR, 0};
   u8 reg[] = {0, 0};
   constexpr int len = sizeof(data) / sizeof(u8);
-  if (m_SPIMaster.WriteRead(SPI_CHIP_SELECT, &data, reg, len) != len) {
+  if (SPIWriteRead(&data, reg, len, m_SPIClocks.Poll) != len) {
     m_Logger.Write(FromKernel, LogPanic, "SPI write error");
   }
   *statusRegister = ParseStatusRegister(reg[1]);
@@ -34,7 +68,7 @@ void CKernel::SetWriteEnableLatch(const bool check_register) {
   constexpr u8 data[] = {ReRAM_WREN};
   constexpr int data_len = sizeof(data) / sizeof(u8);
   // Only needed for WRSR: SetWriteEnable();
-  if (m_SPIMaster.Write(SPI_CHIP_SELECT, data, data_len) != data_len) {
+  if (SPIWrite(data, data_len, m_SPIClocks.WriteEnable) != data_len) {
     m_Logger.Write(FromKernel, LogPanic, "SPI write error");
   }
   // Only needed for WRSR: ResetWriteEnable();
@@ -59,61 +93,184 @@ MeasurementResult CKernel::WIPPollingCycles(u64& cycles, const int timeout) {
   return FailedTotally;
 }
 
-void CKernel::MemWrite(u32 adr, u8 value) {
-#if MEM_ADR_SEND == 2
-  u8 write_data[] = {
-    ReRAM_WR,
-    static_cast<u8>(adr >> 8 & 0xFF),
-    static_cast<u8>(adr >> 0 & 0xFF),
-    value
-  };
-#elif MEM_ADR_SEND == 3
-  u8 write_data[] = {
-    ReRAM_WR,
-    static_cast<u8>(adr >> 16 & 0xFF),
-    static_cast<u8>(adr >> 8 & 0xFF),
-    static_cast<u8>(adr >> 0 & 0xFF),
-    value
-  };
-#endif
+MeasurementResult CKernel::WIPPollingCyclesTimed(u64& cycles, unsigned& maxGap, const int timeout) {
+  MemoryStatusRegister statusRegister;
+  unsigned last = CTimer::GetClockTicks();
+  maxGap = 0;
+  for (u64 i = 1; timeout < 0 || i < static_cast<u64>(timeout); ++i) {
+    ReadStatusRegister(&statusRegister);
+    const unsigned now = CTimer::GetClockTicks();
+    if (now - last > maxGap) maxGap = now - last;
+    last = now;
+    if (!statusRegister.WriteInProgressBit) {
+      cycles = i;
+      return Okay;
+    }
+  }
+  return FailedTotally;
+}
+
+void CKernel::MemWrite(const u32 adr, const u8 value) {
+  u8 write_data[1 + MEM_ADR_SEND + 1];
+  write_data[EncodeAddress(write_data, ReRAM_WR, adr)] = value;
   constexpr int write_len = sizeof(write_data) / sizeof(u8);
 
   SetWriteEnableLatch(false);
   // Only needed for WRSR: SetWriteEnable();
-  if (m_SPIMaster.Write(SPI_CHIP_SELECT, write_data, write_len) != write_len) {
+  if (SPIWrite(write_data, write_len, m_SPIClocks.Write) != write_len) {
     m_Logger.Write(FromKernel, LogPanic, "SPI write error");
   }
+  m_WearTracker.RecordWrite(adr);
   // Only needed for WRSR: ResetWriteEnable();
 }
 
-u8 CKernel::MemRead(u32 adr) {
-#if MEM_ADR_SEND == 2
-  u8 write_data[] = {
-    ReRAM_READ,
-    static_cast<u8>(adr >> 8 & 0xFF),
-    static_cast<u8>(adr >> 0 & 0xFF),
-    0
-  };
-#elif MEM_ADR_SEND == 3
-  u8 write_data[] = {
-    ReRAM_READ,
-    static_cast<u8>(adr >> 16 & 0xFF),
-    static_cast<u8>(adr >> 8 & 0xFF),
-    static_cast<u8>(adr >> 0 & 0xFF),
-    0
-  };
-#endif
+u8 CKernel::MemRead(const u32 adr) {
+  u8 write_data[1 + MEM_ADR_SEND + 1];
+  write_data[EncodeAddress(write_data, ReRAM_READ, adr)] = 0;
   u8 read_data[1 + MEM_ADR_SEND + 1];
 
   constexpr int len = sizeof(write_data) / sizeof(u8);
 
-  if (m_SPIMaster.WriteRead(SPI_CHIP_SELECT, write_data, read_data, len) != len) {
+  if (SPIWriteRead(write_data, read_data, len, m_SPIClocks.Read) != len) {
     m_Logger.Write(FromKernel, LogPanic, "SPI write error");
   }
   return read_data[1 + MEM_ADR_SEND];
 }
 
+void CKernel::MemWritePage(const u32 adr, const u8* values, const unsigned count) {
+  u8 write_data[1 + MEM_ADR_SEND + MEM_PAGE_SIZE];
+  const unsigned header_len = EncodeAddress(write_data, ReRAM_WR, adr);
+  for (unsigned i = 0; i < count; ++i) {
+    write_data[header_len + i] = values[i];
+  }
+  const int write_len = static_cast<int>(header_len + count);
+  // The address wraps around within the page
+  const u32 page = adr / MEM_PAGE_SIZE * MEM_PAGE_SIZE;
+  for (unsigned i = 0; i < count; ++i) {
+    m_WearTracker.RecordWrite(page + (adr + i) % MEM_PAGE_SIZE);
+  }
+
+  SetWriteEnableLatch(false);
+  if (SPIWrite(write_data, write_len, m_SPIClocks.Write) != write_len) {
+    m_Logger.Write(FromKernel, LogPanic, "SPI write error");
+  }
+}
+
+MeasurementResult CKernel::MemWritePageAndPoll(u64& cycles, const u32 adr, const u8* values, const unsigned count,
+                                               const int timeout) {
+  MemWritePage(adr, values, count);
+  return WIPPollingCycles(cycles, timeout);
+}
+
 MeasurementResult CKernel::MemWriteAndPoll(u64& cycles, const u32 adr, const u8 value, const int timeout) {
+#if SPI_ASYNC
+  DiscardPendingPair();
+  TLatencySample sample = {FALSE, TRUE, 0, FALSE};
+  StartMemWriteAndPoll(adr, value, LatencyCallback, sample, timeout);
+  return WaitLatencySample(cycles, sample);
+#else
   MemWrite(adr, value);
   return WIPPollingCycles(cycles, timeout);
+#endif
+}
+
+#if SPI_ASYNC
+
+void CKernel::StartMemWriteAndPoll(const u32 adr, const u8 value, TSPIRequestCallback* pCallback,
+                                   TLatencySample& sample, const int timeout) {
+  TSPIRequest request;
+  request.Type = SPIRequestTransfer;
+  request.PollIndex = 0;
+  request.PollMask = 0;
+  request.Timeout = -1;
+  request.pCallback = WriteStepCallback;
+  request.pParam = &sample;
+
+  // WREN
+  request.Clock = m_SPIClocks.WriteEnable;
+  request.TxData[0] = ReRAM_WREN;
+  request.Length = 1;
+  if (!m_SPIQueue.SubmitWait(request)) {
+    AbandonLatencySample(sample);
+    return;
+  }
+
+  // WR
+  request.Clock = m_SPIClocks.Write;
+  request.Length = EncodeAddress(request.TxData, ReRAM_WR, adr);
+  request.TxData[request.Length++] = value;
+  if (!m_SPIQueue.SubmitWait(request)) {
+    AbandonLatencySample(sample);
+    return;
+  }
+  m_WearTracker.RecordWrite(adr);
+
+  // RDSR until the WriteInProgressBit is cleared
+  request.Type = SPIRequestPoll;
+  request.Clock = m_SPIClocks.Poll;
+  request.TxData[0] = ReRAM_RDSR;
+  request.TxData[1] = 0;
+  request.Length = 2;
+  request.PollIndex = 1;
+  request.PollMask = 0b00000001;
+  request.Timeout = timeout;
+  request.pCallback = pCallback;
+  if (!m_SPIQueue.SubmitWait(request)) AbandonLatencySample(sample);
 }
+
+void CKernel::StartChainedWriteLatency(TLatencySample& sample, const int timeout) {
+  // Same chain as ChainedWriteLatency(u64&, int)
+  sample.Done = FALSE;
+  sample.Status = TRUE;
+  sample.WriteFailed = FALSE;
+  if (m_nChainRemaining == 0) {
+    m_nChainAddr = SelectRandomAddress();
+    StartMemWriteAndPoll(m_nChainAddr, genrand_range(0, 256), FirstWriteCallback, sample, timeout);
+    m_nChainRemaining = m_nChainLength - 1;
+  }
+
+  --m_nChainRemaining;
+  StartMemWriteAndPoll(m_nChainAddr, genrand_range(0, 256), LatencyCallback, sample, timeout);
+}
+
+MeasurementResult CKernel::WaitLatencySample(u64& write_latency, TLatencySample& sample) {
+  const unsigned start = CTimer::GetClockTicks();
+  while (!sample.Done) {
+    if (CTimer::GetClockTicks() - start > SPI_QUEUE_TIMEOUT_US) {
+      m_Logger.Write(FromKernel, LogError, "SPI request queue timed out");
+      AbandonLatencySample(sample);
+      return FailedTotally;
+    }
+  }
+  if (sample.WriteFailed) m_Logger.Write(FromKernel, LogPanic, "SPI write error");
+  if (!sample.Status) return FailedTotally;
+  write_latency = sample.Latency;
+  return Okay;
+}
+
+void CKernel::AbandonLatencySample(TLatencySample& sample) {
+  m_SPIQueue.Detach(&sample);
+  sample.WriteFailed = TRUE;
+  sample.Status = FALSE;
+  sample.Done = TRUE;
+}
+
+void CKernel::WriteStepCallback(const TSPIRequest* pRequest, void* pParam) {
+  if (pRequest->Status) return;
+  auto* pSample = static_cast<TLatencySample*>(pParam);
+  pSample->WriteFailed = TRUE;
+  pSample->Status = FALSE;
+}
+
+void CKernel::FirstWriteCallback(const TSPIRequest* pRequest, void* pParam) {
+  if (!pRequest->Status) static_cast<TLatencySample*>(pParam)->Status = FALSE;
+}
+
+void CKernel::LatencyCallback(const TSPIRequest* pRequest, void* pParam) {
+  auto* pSample = static_cast<TLatencySample*>(pParam);
+  if (!pRequest->Status) pSample->Status = FALSE;
+  pSample->Latency = pRequest->Cycles;
+  pSample->Done = TRUE;
+}
+
+#endif
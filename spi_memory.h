@@ -12,6 +12,18 @@ struct {
   u8 WriteInProgressBit    : 1; // Indicates ReRAM Array or status register are in writing process
 } typedef MemoryStatusRegister;
 
+// Pure bit manipulation, so it also builds on the host (see tools/microbench.cpp)
+inline MemoryStatusRegister ParseStatusRegister(const u8 statusRegister) {
+  return {
+    static_cast<u8>((statusRegister & 0b10000000) >> 7),
+    static_cast<u8>((statusRegister & 0b01000000) >> 6),
+    static_cast<u8>((statusRegister & 0b00100000) >> 5),
+    static_cast<u8>((statusRegister & 0b00001100) >> 2),
+    static_cast<u8>((statusRegister & 0b00000010) >> 1),
+    static_cast<u8>((statusRegister & 0b00000001))
+  };
+}
+
 enum {
   ReRAM_WRSR  = static_cast<u8>(0b00000001),
   ReRAM_WR    = static_cast<u8>(0b00000010),
@@ -26,3 +38,11 @@ enum {
   ReRAM_UDPD  = static_cast<u8>(0b01111001),
   ReRAM_RES   = static_cast<u8>(0b10101011),
 } typedef ReRamInstructions;
+
+// SPI clock in Hz used for each command
+struct TSPIClockProfile {
+  unsigned WriteEnable; // WREN
+  unsigned Write;       // WR
+  unsigned Poll;        // RDSR
+  unsigned Read;        // READ
+};
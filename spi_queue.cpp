@@ -0,0 +1,161 @@
+//
+// spi_queue.cpp
+//
+#include "spi_queue.h"
+
+#include <circle/timer.h>
+#include <circle/util.h>
+
+struct TTransferResult {
+  volatile boolean Done;
+  boolean Status;
+  void* pRxData;
+};
+
+CSPIRequestQueue::CSPIRequestQueue(CInterruptSystem* pInterrupt, const unsigned nClockSpeed, const unsigned CPOL,
+                                   const unsigned CPHA, const unsigned nChipSelect)
+  : m_SPIMaster(pInterrupt, nClockSpeed, CPOL, CPHA),
+    m_nChipSelect(nChipSelect),
+    m_nClock(nClockSpeed),
+    m_nHead(0),
+    m_nTail(0),
+    m_bBusy(FALSE) {}
+
+CSPIRequestQueue::~CSPIRequestQueue() = default;
+
+bool CSPIRequestQueue::Initialize() {
+  if (!m_SPIMaster.Initialize()) return false;
+  m_SPIMaster.SetCompletionRoutine(CompletionRoutine, this);
+  return true;
+}
+
+bool CSPIRequestQueue::Submit(const TSPIRequest& request) {
+  if (request.Length == 0 || request.Length > SPI_REQUEST_MAX_LEN) return false;
+
+  EnterCritical();
+  if (m_nHead - m_nTail >= SPI_QUEUE_SIZE) {
+    LeaveCritical();
+    return false;
+  }
+
+  TSPIRequest& slot = m_Queue[m_nHead & (SPI_QUEUE_SIZE - 1)];
+  slot = request;
+  slot.Cycles = 0;
+  slot.Status = TRUE;
+  ++m_nHead;
+
+  if (!m_bBusy) StartNext();
+  LeaveCritical();
+  return true;
+}
+
+bool CSPIRequestQueue::SubmitWait(const TSPIRequest& request, const unsigned nTimeoutUs) {
+  // Completions keep draining the queue from interrupt context
+  const unsigned nStart = CTimer::GetClockTicks();
+  while (!Submit(request)) {
+    if (CTimer::GetClockTicks() - nStart > nTimeoutUs) return false;
+  }
+  return true;
+}
+
+int CSPIRequestQueue::Transfer(const void* pTxData, void* pRxData, const unsigned nLength, const unsigned nClock) {
+  if (nLength == 0 || nLength > SPI_REQUEST_MAX_LEN) return -1;
+
+  TTransferResult result = {FALSE, FALSE, pRxData};
+
+  TSPIRequest request;
+  request.Type = SPIRequestTransfer;
+  request.Clock = nClock;
+  request.Length = nLength;
+  memcpy(request.TxData, pTxData, nLength);
+  request.PollIndex = 0;
+  request.PollMask = 0;
+  request.Timeout = -1;
+  request.pCallback = TransferCallback;
+  request.pParam = &result;
+
+  if (!SubmitWait(request)) return -1;
+  const unsigned nStart = CTimer::GetClockTicks();
+  while (!result.Done) {
+    if (CTimer::GetClockTicks() - nStart > SPI_QUEUE_TIMEOUT_US) {
+      Detach(&result);
+      return -1;
+    }
+  }
+
+  return result.Status ? static_cast<int>(nLength) : -1;
+}
+
+unsigned CSPIRequestQueue::GetPending() const {
+  return m_nHead - m_nTail;
+}
+
+bool CSPIRequestQueue::Flush(const unsigned nTimeoutUs) const {
+  const unsigned nStart = CTimer::GetClockTicks();
+  while (m_nHead != m_nTail) {
+    if (CTimer::GetClockTicks() - nStart > nTimeoutUs) return false;
+  }
+  return true;
+}
+
+void CSPIRequestQueue::Detach(const void* pParam) {
+  EnterCritical();
+  for (unsigned i = m_nTail; i != m_nHead; ++i) {
+    TSPIRequest& request = m_Queue[i & (SPI_QUEUE_SIZE - 1)];
+    if (request.pParam == pParam) request.pCallback = nullptr;
+  }
+  LeaveCritical();
+}
+
+void CSPIRequestQueue::StartNext() {
+  const TSPIRequest& request = m_Queue[m_nTail & (SPI_QUEUE_SIZE - 1)];
+  memcpy(m_TxBuffer, request.TxData, request.Length);
+  // No transfer is active here, so the clock can be switched safely
+  if (request.Clock != 0 && request.Clock != m_nClock) {
+    m_SPIMaster.SetClock(request.Clock);
+    m_nClock = request.Clock;
+  }
+  m_bBusy = TRUE;
+  m_SPIMaster.StartWriteRead(m_nChipSelect, m_TxBuffer, m_RxBuffer, request.Length);
+}
+
+void CSPIRequestQueue::Complete(const boolean bStatus) {
+  TSPIRequest& request = m_Queue[m_nTail & (SPI_QUEUE_SIZE - 1)];
+  memcpy(request.RxData, m_RxBuffer, request.Length);
+  ++request.Cycles;
+
+  if (!bStatus) {
+    request.Status = FALSE;
+  } else if (request.Type == SPIRequestPoll && (request.RxData[request.PollIndex] & request.PollMask)) {
+    // Same bound as WIPPollingCycles: at most timeout - 1 transfers
+    if (request.Timeout < 0 || request.Cycles + 1 < static_cast<u64>(request.Timeout)) {
+      StartNext();
+      return;
+    }
+    request.Status = FALSE;
+  }
+
+  if (request.pCallback != nullptr) {
+    (*request.pCallback)(&request, request.pParam);
+  }
+
+  ++m_nTail;
+  if (m_nHead != m_nTail) {
+    StartNext();
+  } else {
+    m_bBusy = FALSE;
+  }
+}
+
+void CSPIRequestQueue::CompletionRoutine(const boolean bStatus, void* pParam) {
+  static_cast<CSPIRequestQueue*>(pParam)->Complete(bStatus);
+}
+
+void CSPIRequestQueue::TransferCallback(const TSPIRequest* pRequest, void* pParam) {
+  auto* pResult = static_cast<TTransferResult*>(pParam);
+  if (pResult->pRxData != nullptr) {
+    memcpy(pResult->pRxData, pRequest->RxData, pRequest->Length);
+  }
+  pResult->Status = pRequest->Status;
+  pResult->Done = TRUE;
+}
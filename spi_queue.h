@@ -0,0 +1,95 @@
+#pragma once
+
+#include <circle/interrupt.h>
+#include <circle/spimasterdma.h>
+#include <circle/synchronize.h>
+#include <circle/types.h>
+
+#define SPI_QUEUE_SIZE         64            // Must be a power of two
+#define SPI_REQUEST_MAX_LEN    (1 + 3 + 256) // Instruction, address and one page
+#define SPI_DMA_BUFFER_LEN     ((SPI_REQUEST_MAX_LEN + DMA_ALIGNMENT - 1) / DMA_ALIGNMENT * DMA_ALIGNMENT)
+#define SPI_QUEUE_TIMEOUT_US   1000000       // Default bound of the blocking calls; only hit if DMA stops completing
+
+enum TSPIRequestType {
+  // Transfer once and complete
+  SPIRequestTransfer,
+  // Repeat the transfer until (RxData[PollIndex] & PollMask) == 0 or the timeout is hit
+  SPIRequestPoll
+};
+
+struct TSPIRequest;
+
+// Called from interrupt context once a request has completed
+typedef void TSPIRequestCallback(const TSPIRequest* pRequest, void* pParam);
+
+struct TSPIRequest {
+  TSPIRequestType Type;
+  unsigned Clock; // SPI clock in Hz; 0 keeps the current one
+  unsigned Length;
+  u8 TxData[SPI_REQUEST_MAX_LEN];
+  u8 RxData[SPI_REQUEST_MAX_LEN];
+  unsigned PollIndex;
+  u8 PollMask;
+  int Timeout;
+  TSPIRequestCallback* pCallback;
+  void* pParam;
+
+  // Filled in by the queue
+  u64 Cycles;     // Number of transfers done for this request (same semantics as WIPPollingCycles)
+  boolean Status; // FALSE on SPI error or poll timeout
+};
+
+/**
+ * Submission queue of pre-encoded SPI transactions, executed one after another via DMA.
+ * Requests are completed in FIFO order, so synchronous transfers may be mixed with asynchronous ones.
+ */
+class CSPIRequestQueue {
+public:
+  CSPIRequestQueue(CInterruptSystem* pInterrupt, unsigned nClockSpeed, unsigned CPOL, unsigned CPHA,
+                   unsigned nChipSelect);
+
+  ~CSPIRequestQueue();
+
+  bool Initialize();
+
+  // Does not block; returns false if the queue is full
+  bool Submit(const TSPIRequest& request);
+
+  // Blocks until the queue had space for the request; returns false on timeout
+  bool SubmitWait(const TSPIRequest& request, unsigned nTimeoutUs = SPI_QUEUE_TIMEOUT_US);
+
+  // Blocks until the transfer has been executed; returns the number of transferred bytes or -1 on error or timeout
+  int Transfer(const void* pTxData, void* pRxData, unsigned nLength, unsigned nClock = 0);
+
+  unsigned GetPending() const;
+
+  // Blocks until all submitted requests have completed; returns false on timeout
+  bool Flush(unsigned nTimeoutUs = SPI_QUEUE_TIMEOUT_US) const;
+
+  // Drops the callbacks of the pending requests with pParam, so the caller may give up on them (e.g. after a
+  // timeout) and release pParam; the requests themselves are still executed
+  void Detach(const void* pParam);
+
+private:
+  // Must be called with IRQs disabled
+  void StartNext();
+
+  void Complete(boolean bStatus);
+
+  static void CompletionRoutine(boolean bStatus, void* pParam);
+
+  static void TransferCallback(const TSPIRequest* pRequest, void* pParam);
+
+private:
+  CSPIMasterDMA m_SPIMaster;
+  unsigned m_nChipSelect;
+  unsigned m_nClock;
+
+  TSPIRequest m_Queue[SPI_QUEUE_SIZE];
+  volatile unsigned m_nHead; // Next slot to fill
+  volatile unsigned m_nTail; // Active request, if m_bBusy
+  volatile boolean m_bBusy;
+
+  DMA_BUFFER(u8, m_TxBuffer, SPI_DMA_BUFFER_LEN);
+  DMA_BUFFER(u8, m_RxBuffer, SPI_DMA_BUFFER_LEN);
+};
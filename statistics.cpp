@@ -0,0 +1,79 @@
+//
+// statistics.cpp
+//
+#include "statistics.h"
+
+static void SiftDown(u64* samples, unsigned root, const unsigned count) {
+  for (unsigned child; (child = 2 * root + 1) < count; root = child) {
+    if (child + 1 < count && samples[child] < samples[child + 1]) ++child;
+    if (!(samples[root] < samples[child])) return;
+    const u64 temp = samples[root];
+    samples[root] = samples[child];
+    samples[child] = temp;
+  }
+}
+
+void SortSamples(u64* samples, const unsigned count) {
+  for (unsigned i = count / 2; i-- > 0;) SiftDown(samples, i, count);
+  for (unsigned end = count; end-- > 1;) {
+    const u64 temp = samples[0];
+    samples[0] = samples[end];
+    samples[end] = temp;
+    SiftDown(samples, 0, end);
+  }
+}
+
+double Log2(double x) {
+  if (x <= 0) return -1e300;
+
+  // x = m * 2^e with m in [1, 2)
+  u64 raw;
+  __builtin_memcpy(&raw, &x, sizeof(raw));
+  int e = static_cast<int>((raw >> 52) & 0x7FF) - 1023;
+  raw = (raw & 0x000FFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL;
+  double m;
+  __builtin_memcpy(&m, &raw, sizeof(m));
+  if (m > 1.41421356237309504880) {
+    m /= 2;
+    ++e;
+  }
+
+  // ln(m) = 2 * atanh((m - 1) / (m + 1))
+  const double t = (m - 1) / (m + 1);
+  const double t2 = t * t;
+  double term = t, sum = 0;
+  for (int k = 1; k < 40; k += 2) {
+    sum += term / k;
+    term *= t2;
+  }
+  return e + 2 * sum * 1.44269504088896340736;
+}
+
+void ComputeStatistics(TLatencyStatistics& stats, u64* samples, const unsigned count) {
+  stats = TLatencyStatistics{};
+  stats.Count = count;
+  if (count == 0) return;
+
+  SortSamples(samples, count);
+  stats.Min = samples[0];
+  stats.Max = samples[count - 1];
+  stats.Median = samples[count / 2];
+  stats.P99 = samples[static_cast<u64>(count) * 99 / 100];
+
+  double sum = 0;
+  unsigned ones = 0, mostCommon = 0;
+  for (unsigned i = 0; i < count;) {
+    unsigned j = i;
+    while (j < count && samples[j] == samples[i]) ++j;
+    const unsigned run = j - i;
+    const double p = static_cast<double>(run) / count;
+    stats.ShannonEntropy -= p * Log2(p);
+    if (run > mostCommon) mostCommon = run;
+    sum += static_cast<double>(samples[i]) * run;
+    if (samples[i] & 1) ones += run;
+    i = j;
+  }
+  stats.Mean = sum / count;
+  stats.MinEntropy = -Log2(static_cast<double>(mostCommon) / count);
+  stats.LSBOnes = static_cast<double>(ones) / count;
+}
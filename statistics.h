@@ -0,0 +1,24 @@
+#pragma once
+
+#include <circle/types.h>
+
+struct TLatencyStatistics {
+  unsigned Count;
+  u64 Min;
+  u64 Max;
+  u64 Median;
+  u64 P99;
+  double Mean;
+  double ShannonEntropy; // Bits per sample
+  double MinEntropy;     // Bits per sample
+  double LSBOnes;        // Fraction of samples with the LSB set
+};
+
+// In-place heapsort (no allocations, no recursion)
+void SortSamples(u64* samples, unsigned count);
+
+// log2 without libm
+double Log2(double x);
+
+// Sorts samples in place
+void ComputeStatistics(TLatencyStatistics& stats, u64* samples, unsigned count);
@@ -0,0 +1,297 @@
+//
+// merge_shards.cpp
+//
+// Merges the raw mode files (*_measure.log) of several boards that each measured one shard (shard_index,
+// shard_count) into one dataset. The provenance headers must agree and every row is checked against the
+// (cell, num1, num2) combinations its shard was supposed to measure.
+//
+#include <circle/types.h>
+#include "../measurement_format.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+struct TShardFile {
+  std::string Path;
+  std::map<std::string, std::string> Header; // key=value pairs of the provenance header
+  unsigned Index = 0;
+  unsigned Count = 0;
+  std::string Data;                          // Everything after the header
+  std::vector<size_t> SweepStart;            // Offset of the rows of each sweep in Data, plus the trailer
+};
+
+static bool Fail(const std::string& path, const std::string& message) {
+  fprintf(stderr, "%s: %s\n", path.c_str(), message.c_str());
+  return false;
+}
+
+static std::vector<std::string> Split(const std::string& text, const char separator) {
+  std::vector<std::string> parts;
+  size_t start = 0;
+  for (;;) {
+    const size_t end = text.find(separator, start);
+    parts.push_back(text.substr(start, end - start));
+    if (end == std::string::npos) return parts;
+    start = end + 1;
+  }
+}
+
+static bool ParseUnsigned(const std::string& text, unsigned& value) {
+  if (text.empty()) return false;
+  char* end;
+  const unsigned long number = strtoul(text.c_str(), &end, 10);
+  if (*end != '\0' || number > 0xFFFFFFFFUL) return false;
+  value = static_cast<unsigned>(number);
+  return true;
+}
+
+// Sweeps in header order: <name>=<type>/<cell;...>/<all|num1:num2;...>/<tries>
+static bool ParseSweeps(const TShardFile& file, std::vector<TRawSweep>& sweeps, std::vector<std::string>& names) {
+  for (const auto& key : Split(file.Header.at("sweeps"), ';')) {
+    const auto entry = file.Header.find(key);
+    if (entry == file.Header.end()) return Fail(file.Path, "sweep " + key + " is missing");
+    const std::vector<std::string> fields = Split(entry->second, '/');
+    if (fields.size() != 4 || fields[0].size() != 1) return Fail(file.Path, "malformed sweep " + key);
+
+    TRawSweep sweep = {};
+    sweep.Type = fields[0][0];
+    for (const auto& cell : Split(fields[1], ';')) {
+      unsigned value;
+      if (sweep.CellCount == RAW_MAX_CELLS || !ParseUnsigned(cell, value)) {
+        return Fail(file.Path, "malformed cells of " + key);
+      }
+      sweep.Cells[sweep.CellCount++] = value;
+    }
+    if (fields[2] == "all") {
+      sweep.PairCount = RAW_FULL_PAIRS;
+    } else {
+      for (const auto& pair : Split(fields[2], ';')) {
+        const std::vector<std::string> nums = Split(pair, ':');
+        unsigned num1, num2;
+        if (sweep.PairCount == RAW_MAX_PAIRS || nums.size() != 2 || !ParseUnsigned(nums[0], num1) ||
+            !ParseUnsigned(nums[1], num2) || num1 > 255 || num2 > 255) {
+          return Fail(file.Path, "malformed byte pairs of " + key);
+        }
+        sweep.Num1s[sweep.PairCount] = static_cast<u8>(num1);
+        sweep.Num2s[sweep.PairCount++] = static_cast<u8>(num2);
+      }
+    }
+    if (!ParseUnsigned(fields[3], sweep.Tries)) return Fail(file.Path, "malformed tries of " + key);
+    names.push_back(key);
+    sweeps.push_back(sweep);
+  }
+  return true;
+}
+
+static bool ReadShard(const char* path, TShardFile& file) {
+  file.Path = path;
+  FILE* input = fopen(path, "rb");
+  if (input == nullptr) return Fail(path, "cannot open file");
+  std::string content;
+  char buffer[1 << 16];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), input)) > 0) content.append(buffer, read);
+  fclose(input);
+
+  const size_t headerEnd = content.find('\n');
+  if (content.compare(0, strlen(RAW_HEADER), RAW_HEADER) != 0 || headerEnd == std::string::npos) {
+    return Fail(path, "no raw measurement header (recorded before sharding was supported?)");
+  }
+  // Sweeps are the values with a slash (except the shard), in the order of the file
+  std::string sweeps;
+  for (const auto& field : Split(content.substr(0, headerEnd), ',')) {
+    const size_t equals = field.find('=');
+    if (equals == std::string::npos) continue;
+    const std::string key = field.substr(0, equals);
+    file.Header[key] = field.substr(equals + 1);
+    if (field.find('/', equals) != std::string::npos && key != "shard") sweeps += (sweeps.empty() ? "" : ";") + key;
+  }
+  file.Header["sweeps"] = sweeps;
+  file.Data = content.substr(headerEnd + 1);
+
+  unsigned version;
+  if (!ParseUnsigned(file.Header["version"], version) || version != RAW_VERSION) {
+    return Fail(path, "unsupported version " + file.Header["version"]);
+  }
+  const std::vector<std::string> shard = Split(file.Header["shard"], '/');
+  if (shard.size() != 2 || !ParseUnsigned(shard[0], file.Index) || !ParseUnsigned(shard[1], file.Count) ||
+      file.Index >= file.Count) {
+    return Fail(path, "malformed shard " + file.Header["shard"]);
+  }
+  return true;
+}
+
+// Checks that the rows are exactly the combinations of the shard, tries times each, followed by the trailer
+static bool ValidateRows(TShardFile& file, const std::vector<TRawSweep>& sweeps,
+                         const std::vector<std::string>& names) {
+  size_t pos = 0;
+  u64 rows = 0;
+  for (size_t s = 0; s < sweeps.size(); ++s) {
+    const TRawSweep& sweep = sweeps[s];
+    file.SweepStart.push_back(pos);
+    u32 first, count;
+    sweep.GetShard(file.Index, file.Count, first, count);
+    for (u32 i = first; i < first + count; ++i) {
+      for (unsigned k = 0; k < sweep.Tries; ++k) {
+        const size_t end = file.Data.find('\n', pos);
+        if (end == std::string::npos) {
+          return Fail(file.Path, "truncated in sweep " + names[s] + " after " + std::to_string(rows) + " rows");
+        }
+        char type;
+        unsigned addr, num1, num2, prev;
+        unsigned long long latency, firstLatency;
+        if (sscanf(file.Data.c_str() + pos, "%c,%u,%u,%u,%llu,%u,%llu", &type, &addr, &num1, &num2, &latency, &prev,
+                   &firstLatency) != 7 ||
+            type != sweep.Type || addr != sweep.GetCell(i) || num1 != sweep.GetNum1(i) ||
+            num2 != sweep.GetNum2(i)) {
+          return Fail(file.Path, "unexpected row " + std::to_string(rows + 1) + ": " +
+                                 file.Data.substr(pos, end - pos));
+        }
+        pos = end + 1;
+        ++rows;
+      }
+    }
+  }
+  file.SweepStart.push_back(pos);
+
+  unsigned long long trailerRows;
+  if (sscanf(file.Data.c_str() + pos, RAW_TRAILER ",rows=%llu", &trailerRows) != 1) {
+    return Fail(file.Path, "trailer missing (incomplete file?)");
+  }
+  if (trailerRows != rows) {
+    return Fail(file.Path, "trailer counts " + std::to_string(trailerRows) + " rows, found " + std::to_string(rows));
+  }
+  return true;
+}
+
+static void Usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [-o merged.log] shard.log...\n"
+          "  -o <file>    Write the merged dataset to file (default: only validate)\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  const char* output = nullptr;
+  std::vector<const char*> paths;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (argv[i][0] == '-') {
+      Usage(argv[0]);
+      return 2;
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty()) {
+    Usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<TShardFile> files(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (!ReadShard(paths[i], files[i])) return 1;
+  }
+
+  // Same configuration everywhere; only the shard and the board differ
+  const TShardFile& reference = files[0];
+  for (const auto& file : files) {
+    for (const auto& entry : reference.Header) {
+      if (entry.first == "shard" || entry.first == "board") continue;
+      const auto other = file.Header.find(entry.first);
+      if (other == file.Header.end() || other->second != entry.second) {
+        Fail(file.Path, entry.first + " differs from " + reference.Path);
+        return 1;
+      }
+    }
+    if (file.Header.size() != reference.Header.size()) {
+      Fail(file.Path, "header keys differ from " + reference.Path);
+      return 1;
+    }
+  }
+
+  // Every shard exactly once
+  const unsigned shards = reference.Count;
+  std::vector<TShardFile*> byIndex(shards, nullptr);
+  for (auto& file : files) {
+    if (file.Count != shards) {
+      Fail(file.Path, "shard count " + std::to_string(file.Count) + " differs from " + reference.Path);
+      return 1;
+    }
+    if (byIndex[file.Index] != nullptr) {
+      Fail(file.Path, "shard " + std::to_string(file.Index) + " is also in " + byIndex[file.Index]->Path);
+      return 1;
+    }
+    byIndex[file.Index] = &file;
+  }
+  int status = 0;
+  for (unsigned i = 0; i < shards; ++i) {
+    if (byIndex[i] == nullptr) {
+      fprintf(stderr, "shard %u of %u is missing\n", i, shards);
+      status = 1;
+    }
+  }
+  if (status != 0) return status;
+
+  std::vector<TRawSweep> sweeps;
+  std::vector<std::string> names;
+  if (!ParseSweeps(reference, sweeps, names)) return 1;
+
+  std::map<std::string, std::string> boards;
+  for (auto* file : byIndex) {
+    if (!ValidateRows(*file, sweeps, names)) return 1;
+    const std::string& board = file->Header["board"];
+    if (board != "0000000000000000" && boards.count(board) != 0) {
+      fprintf(stderr, "warning: %s and %s were measured on the same board %s\n", boards[board].c_str(),
+              file->Path.c_str(), board.c_str());
+    }
+    boards[board] = file->Path;
+    printf("%s: shard %u of %u, board %s, valid\n", file->Path.c_str(), file->Index, shards, board.c_str());
+  }
+
+  if (output == nullptr) return 0;
+  FILE* out = fopen(output, "wb");
+  if (out == nullptr) {
+    fprintf(stderr, "%s: cannot create file\n", output);
+    return 1;
+  }
+
+  // Header of an unsharded run, with the boards of all shards in shard order
+  std::string header = RAW_HEADER ",version=" + reference.Header.at("version") + ",shard=0/1,board=";
+  for (unsigned i = 0; i < shards; ++i) header += (i ? ";" : "") + byIndex[i]->Header["board"];
+  for (const char* key : {"mem", "mem_type", "spi_freq_wren", "spi_freq_write", "spi_freq_poll", "spi_freq_read",
+                          "spi_async"}) {
+    // spi_async is missing in files of builds before it was recorded
+    if (reference.Header.count(key) == 0) continue;
+    header += std::string(",") + key + "=" + reference.Header.at(key);
+  }
+  for (const auto& name : names) header += "," + name + "=" + reference.Header.at(name);
+  header += "\n";
+  fwrite(header.data(), 1, header.size(), out);
+
+  // Sweep by sweep, the shards in order: the same row order as a single board
+  u64 rows = 0;
+  for (size_t s = 0; s < sweeps.size(); ++s) {
+    for (auto* file : byIndex) {
+      const size_t start = file->SweepStart[s];
+      const size_t length = file->SweepStart[s + 1] - start;
+      fwrite(file->Data.data() + start, 1, length, out);
+    }
+    u32 first, count;
+    sweeps[s].GetShard(0, 1, first, count);
+    rows += static_cast<u64>(count) * sweeps[s].Tries;
+  }
+  fprintf(out, RAW_TRAILER ",rows=%llu\n", static_cast<unsigned long long>(rows));
+
+  if (fclose(out) != 0) {
+    fprintf(stderr, "%s: write error\n", output);
+    return 1;
+  }
+  printf("Merged %u shards, %llu rows into %s\n", shards, static_cast<unsigned long long>(rows), output);
+  return 0;
+}
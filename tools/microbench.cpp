@@ -0,0 +1,281 @@
+//
+// microbench.cpp
+//
+// Micro-benchmarks of the pure-compute parts of the kernel (Mersenne Twister, status register parsing, quantiser
+// and von Neumann extractor, raw mode CSV rows) on the host. Results can be appended to a history file and compared
+// against the previous revision, so that hot path regressions show up without a Pi.
+//
+#include <circle/types.h>
+#include "../extractor.h"
+#include "../measurement_format.h"
+#include "../mt19937ar.h"
+#include "../spi_memory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+// Allocation counter; the kernel has no general purpose heap in its hot paths, so neither should these
+static u64 s_Allocations = 0;
+
+void* operator new(const size_t size) {
+  ++s_Allocations;
+  void* p = malloc(size ? size : 1);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+// Keeps results of the benchmarked code alive
+static volatile u64 s_Sink;
+
+struct TOptions {
+  double MinMilliseconds = 200;
+  unsigned Repetitions = 5;
+  std::string Filter;
+  std::string History;
+  std::string Revision;
+  double Threshold = 10; // Percent
+};
+
+struct TResult {
+  std::string Name;
+  double NsPerOp;
+  double BytesPerSecond;
+  double AllocationsPerOp;
+};
+
+// Runs batch(n) (n operations, returning the number of bytes processed) until MinMilliseconds have passed,
+// repeats that and keeps the fastest repetition
+template <typename TBatch>
+static TResult Measure(const char* name, const TOptions& options, TBatch batch) {
+  using Clock = std::chrono::steady_clock;
+  batch(1024); // Warm-up
+
+  TResult best = {name, 0, 0, 0};
+  for (unsigned r = 0; r < options.Repetitions; ++r) {
+    u64 ops = 0, bytes = 0;
+    const u64 allocations = s_Allocations;
+    const auto start = Clock::now();
+    double elapsed;
+    u64 n = 1024;
+    do {
+      bytes += batch(n);
+      ops += n;
+      n *= 2;
+      elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    } while (elapsed < options.MinMilliseconds);
+
+    const double nsPerOp = elapsed * 1e6 / static_cast<double>(ops);
+    if (r == 0 || nsPerOp < best.NsPerOp) {
+      best.NsPerOp = nsPerOp;
+      best.BytesPerSecond = static_cast<double>(bytes) / elapsed * 1e3;
+      best.AllocationsPerOp = static_cast<double>(s_Allocations - allocations) / static_cast<double>(ops);
+    }
+  }
+  return best;
+}
+
+static std::vector<TResult> RunBenchmarks(const TOptions& options) {
+  std::vector<TResult> results;
+  auto selected = [&](const char* name) {
+    return options.Filter.empty() || strstr(name, options.Filter.c_str()) != nullptr;
+  };
+
+  init_genrand(5489);
+
+  if (selected("genrand_int32")) {
+    results.push_back(Measure("genrand_int32", options, [](const u64 n) {
+      u64 sink = 0;
+      for (u64 i = 0; i < n; ++i) sink += genrand_int32();
+      s_Sink = sink;
+      return n * sizeof(u32);
+    }));
+  }
+
+  if (selected("genrand_range")) {
+    results.push_back(Measure("genrand_range", options, [](const u64 n) {
+      u64 sink = 0;
+      for (u64 i = 0; i < n; ++i) sink += genrand_range(0, MEM_SIZE_ADR);
+      s_Sink = sink;
+      return n * sizeof(u32);
+    }));
+  }
+
+  if (selected("parse_status")) {
+    results.push_back(Measure("parse_status", options, [](const u64 n) {
+      u64 sink = 0;
+      for (u64 i = 0; i < n; ++i) {
+        const MemoryStatusRegister reg = ParseStatusRegister(static_cast<u8>(i ^ s_Sink));
+        sink += reg.WriteInProgressBit + reg.BlockProtectionBits;
+      }
+      s_Sink = sink;
+      return n;
+    }));
+  }
+
+  // Latencies like the ones of ExtractSingleBit: a few distinct values around a mean
+  std::vector<u64> latencies(1 << 16);
+  for (auto& latency : latencies) latency = 100 + genrand_range(0, 8);
+  const size_t mask = latencies.size() - 1;
+
+  // ExtractLatencyPair() as called by CKernel::ExtractSingleBit; one operation is one pair of latencies
+  for (const bool median : {false, true}) {
+    const char* name = median ? "von_neumann_median" : "von_neumann";
+    if (!selected(name)) continue;
+    CLatencyBaseline baseline;
+    results.push_back(Measure(name, options, [&](const u64 n) {
+      u64 sink = 0;
+      for (u64 i = 0; i < n; ++i) {
+        bool bit;
+        if (ExtractLatencyPair(baseline, median, latencies[2 * i & mask], latencies[(2 * i + 1) & mask], bit)) {
+          sink += bit + 1;
+        }
+      }
+      s_Sink = sink;
+      return n * 2 * sizeof(u64);
+    }));
+  }
+
+  if (selected("measurement_row")) {
+    // Bytes are the formatted output
+    results.push_back(Measure("measurement_row", options, [&](const u64 n) {
+      char row[MEASUREMENT_ROW_MAX];
+      u64 bytes = 0;
+      for (u64 i = 0; i < n; ++i) {
+        bytes += FormatMeasurementRow(row, 'S', static_cast<u32>(i & 0xFFFF), static_cast<u8>(i),
+                                      static_cast<u8>(i >> 8), latencies[i & mask], static_cast<u8>(i >> 16),
+                                      latencies[(i + 1) & mask]);
+      }
+      s_Sink = bytes + static_cast<u8>(row[0]);
+      return bytes;
+    }));
+  }
+
+  return results;
+}
+
+static std::string CurrentRevision() {
+  std::string revision;
+  FILE* pipe = popen("git rev-parse --short HEAD 2>/dev/null", "r");
+  if (pipe != nullptr) {
+    char line[64];
+    if (fgets(line, sizeof(line), pipe) != nullptr) revision = line;
+    pclose(pipe);
+  }
+  while (!revision.empty() && (revision.back() == '\n' || revision.back() == '\r')) revision.pop_back();
+  return revision.empty() ? "unknown" : revision;
+}
+
+// Latest entry per benchmark of another revision than the current one
+static std::map<std::string, TResult> ReadBaseline(const std::string& path, const std::string& revision) {
+  std::map<std::string, TResult> baseline;
+  FILE* file = fopen(path.c_str(), "r");
+  if (file == nullptr) return baseline;
+  char line[256];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    char rev[64], name[64];
+    TResult result;
+    if (sscanf(line, "%63[^,],%63[^,],%lf,%lf,%lf", rev, name, &result.NsPerOp, &result.BytesPerSecond,
+               &result.AllocationsPerOp) != 5) {
+      continue; // Header
+    }
+    if (revision == rev) continue;
+    result.Name = name;
+    baseline[name] = result;
+  }
+  fclose(file);
+  return baseline;
+}
+
+static bool AppendHistory(const std::string& path, const std::string& revision, const std::vector<TResult>& results) {
+  FILE* probe = fopen(path.c_str(), "r");
+  const bool exists = probe != nullptr;
+  if (probe != nullptr) fclose(probe);
+
+  FILE* file = fopen(path.c_str(), "a");
+  if (file == nullptr) {
+    fprintf(stderr, "%s: cannot open history file\n", path.c_str());
+    return false;
+  }
+  if (!exists) fprintf(file, "rev,name,ns_per_op,bytes_per_s,allocs_per_op\n");
+  for (const auto& result : results) {
+    fprintf(file, "%s,%s,%.4f,%.0f,%.4f\n", revision.c_str(), result.Name.c_str(), result.NsPerOp,
+            result.BytesPerSecond, result.AllocationsPerOp);
+  }
+  return fclose(file) == 0;
+}
+
+static void Usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -f <filter>   Only run benchmarks whose name contains filter\n"
+          "  -t <ms>       Minimum time per repetition (default: 200)\n"
+          "  -n <count>    Repetitions; the fastest one counts (default: 5)\n"
+          "  -H <file>     Compare with the previous revision in file and append the results to it\n"
+          "  -r <rev>      Revision to record (default: git rev-parse --short HEAD)\n"
+          "  -T <percent>  Slowdown that counts as a regression (default: 10)\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  TOptions options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "-f" && hasValue) {
+      options.Filter = argv[++i];
+    } else if (arg == "-t" && hasValue) {
+      options.MinMilliseconds = std::max(1.0, atof(argv[++i]));
+    } else if (arg == "-n" && hasValue) {
+      options.Repetitions = static_cast<unsigned>(std::max(1, atoi(argv[++i])));
+    } else if (arg == "-H" && hasValue) {
+      options.History = argv[++i];
+    } else if (arg == "-r" && hasValue) {
+      options.Revision = argv[++i];
+    } else if (arg == "-T" && hasValue) {
+      options.Threshold = atof(argv[++i]);
+    } else {
+      Usage(argv[0]);
+      return 2;
+    }
+  }
+  if (options.Revision.empty()) options.Revision = CurrentRevision();
+
+  std::map<std::string, TResult> baseline;
+  if (!options.History.empty()) baseline = ReadBaseline(options.History, options.Revision);
+
+  const std::vector<TResult> results = RunBenchmarks(options);
+
+  int status = 0;
+  printf("%-20s %12s %14s %10s  %s\n", "benchmark", "ns/op", "MB/s", "allocs/op", "change");
+  for (const auto& result : results) {
+    char change[64] = "";
+    const auto previous = baseline.find(result.Name);
+    if (previous != baseline.end() && previous->second.NsPerOp > 0) {
+      const double percent = (result.NsPerOp / previous->second.NsPerOp - 1) * 100;
+      const bool regression = percent > options.Threshold ||
+                              result.AllocationsPerOp > previous->second.AllocationsPerOp;
+      snprintf(change, sizeof(change), "%+.1f%%%s", percent, regression ? " REGRESSION" : "");
+      if (regression) status = 1;
+    }
+    printf("%-20s %12.3f %14.1f %10.4f  %s\n", result.Name.c_str(), result.NsPerOp, result.BytesPerSecond / 1e6,
+           result.AllocationsPerOp, change);
+  }
+
+  if (!options.History.empty() && !AppendHistory(options.History, options.Revision, results)) status = 2;
+  return status;
+}
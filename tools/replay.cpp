@@ -0,0 +1,365 @@
+//
+// replay.cpp
+//
+// Replays raw latency traces (trace mode) through the quantiser, von Neumann extractor and health tests of the
+// kernel, so that extractor experiments do not need new hardware runs.
+//
+#include <circle/types.h>
+#include "../extractor.h"
+#include "../health_tests.h"
+#include "../trace_format.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(__BMI2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Samples per chunk granule; keeps pairs and packed words aligned across threads
+static constexpr size_t Granule = 64;
+
+struct TOptions {
+  unsigned Threads = std::max(1u, std::thread::hardware_concurrency());
+  bool Scalar = false;
+  bool Median = false;
+  bool WritePacked = false;
+  bool WriteAscii = false;
+  unsigned RCTCutoff = HEALTH_RCT_CUTOFF;
+  unsigned APTCutoff = HEALTH_APT_CUTOFF;
+  unsigned APTWindow = HEALTH_APT_WINDOW;
+};
+
+struct TChunkResult {
+  std::vector<u64> Bits; // von Neumann output, LSB first
+  u64 BitCount = 0;
+  u64 Valid = 0;
+  u64 RawOnes = 0;
+  unsigned RCTFailures = 0; // Only of the merged result, see RunHealthTests
+  unsigned APTFailures = 0;
+  std::vector<u64> Histogram;
+  u64 Baseline = 0;
+};
+
+// Packs the quantised bits and the validity of 64 samples into one word each
+static void PackScalar(const u16* samples, u64& bits, u64& valid) {
+  bits = 0;
+  valid = 0;
+  for (unsigned i = 0; i < 64; ++i) {
+    bits |= static_cast<u64>(QuantiseLatency(samples[i])) << i;
+    valid |= static_cast<u64>(samples[i] != TRACE_INVALID_SAMPLE) << i;
+  }
+}
+
+static void Pack(const u16* samples, u64& bits, u64& valid) {
+#if defined(__AVX2__)
+  bits = 0;
+  valid = 0;
+  const __m256i zero = _mm256_setzero_si256();
+  for (unsigned i = 0; i < 64; i += 32) {
+    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + i));
+    const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + i + 16));
+    // packs works per 128 bit lane, so the quadwords need to be reordered afterwards
+    const __m256i lsb = _mm256_permute4x64_epi64(
+      _mm256_packs_epi16(_mm256_slli_epi16(a, 15), _mm256_slli_epi16(b, 15)), 0xD8);
+    const __m256i invalid = _mm256_permute4x64_epi64(
+      _mm256_packs_epi16(_mm256_cmpeq_epi16(a, zero), _mm256_cmpeq_epi16(b, zero)), 0xD8);
+    bits |= static_cast<u64>(static_cast<u32>(_mm256_movemask_epi8(lsb))) << i;
+    valid |= static_cast<u64>(~static_cast<u32>(_mm256_movemask_epi8(invalid))) << i;
+  }
+#elif defined(__SSE2__)
+  bits = 0;
+  valid = 0;
+  const __m128i zero = _mm_setzero_si128();
+  for (unsigned i = 0; i < 64; i += 16) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i + 8));
+    const __m128i lsb = _mm_packs_epi16(_mm_slli_epi16(a, 15), _mm_slli_epi16(b, 15));
+    const __m128i invalid = _mm_packs_epi16(_mm_cmpeq_epi16(a, zero), _mm_cmpeq_epi16(b, zero));
+    bits |= static_cast<u64>(_mm_movemask_epi8(lsb)) << i;
+    valid |= static_cast<u64>(~_mm_movemask_epi8(invalid) & 0xFFFF) << i;
+  }
+#elif defined(__ARM_NEON)
+  bits = 0;
+  valid = 0;
+  static const int16_t shifts[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+  const int16x8_t shift = vld1q_s16(shifts);
+  const uint16x8_t one = vdupq_n_u16(1);
+  for (unsigned i = 0; i < 64; i += 8) {
+    const uint16x8_t v = vld1q_u16(samples + i);
+    const uint16x8_t lsb = vandq_u16(v, one);
+    const uint16x8_t nonzero = vandq_u16(vmvnq_u16(vceqzq_u16(v)), one);
+    bits |= static_cast<u64>(vaddvq_u16(vshlq_u16(lsb, shift))) << i;
+    valid |= static_cast<u64>(vaddvq_u16(vshlq_u16(nonzero, shift))) << i;
+  }
+#else
+  PackScalar(samples, bits, valid);
+#endif
+}
+
+// Gathers the bits of value selected by mask into the low bits of the result
+static u64 Extract(const u64 value, u64 mask) {
+#if defined(__BMI2__)
+  return _pext_u64(value, mask);
+#else
+  u64 result = 0;
+  for (unsigned i = 0; mask; ++i) {
+    const u64 lowest = mask & -mask;
+    if (value & lowest) result |= static_cast<u64>(1) << i;
+    mask ^= lowest;
+  }
+  return result;
+#endif
+}
+
+// Like PackScalar, but with the drift-tracking quantiser of the kernel (quantiser=median)
+static void PackMedian(const u16* samples, CLatencyBaseline& baseline, u64& bits, u64& valid) {
+  bits = 0;
+  valid = 0;
+  for (unsigned i = 0; i < 64; ++i) {
+    if (samples[i] == TRACE_INVALID_SAMPLE) continue;
+    bits |= static_cast<u64>(baseline.Quantise(samples[i])) << i;
+    valid |= 1ULL << i;
+  }
+}
+
+static void AppendBits(std::vector<u64>& out, u64& count, const u64 bits, const unsigned n) {
+  if (n == 0) return;
+  const unsigned offset = count % 64;
+  if (offset == 0) {
+    out.push_back(bits);
+  } else {
+    out.back() |= bits << offset;
+    if (offset + n > 64) out.push_back(bits >> (64 - offset));
+  }
+  count += n;
+}
+
+// The runs of the health tests cross chunk boundaries, so they see all samples in order on one thread
+static void RunHealthTests(const u16* samples, const size_t count, const TOptions& options, TChunkResult& result) {
+  CHealthTests tests(options.RCTCutoff, options.APTCutoff, options.APTWindow);
+  for (size_t i = 0; i < count; ++i) {
+    if (samples[i] != TRACE_INVALID_SAMPLE) tests.Feed(samples[i]);
+  }
+  result.RCTFailures = tests.GetRepetitionFailures();
+  result.APTFailures = tests.GetProportionFailures();
+}
+
+static void ProcessChunk(const u16* samples, const size_t count, const TOptions& options, TChunkResult& result) {
+  CLatencyBaseline baseline;
+  result.Histogram.assign(TRACE_MAX_SAMPLE + 1, 0);
+  result.Bits.reserve(count / 256 + 1);
+
+  constexpr u64 evenPositions = 0x5555555555555555ULL;
+  for (size_t i = 0; i < count; i += 64) {
+    u64 bits, valid;
+    if (options.Median) {
+      PackMedian(samples + i, baseline, bits, valid);
+    } else if (options.Scalar) {
+      PackScalar(samples + i, bits, valid);
+    } else {
+      Pack(samples + i, bits, valid);
+    }
+
+    // A failed measurement discards its whole pair, just like ExtractSingleBit
+    const u64 pairs = valid & (valid >> 1) & evenPositions;
+    const u64 differ = (bits ^ (bits >> 1)) & pairs;
+    AppendBits(result.Bits, result.BitCount, Extract(bits, differ), __builtin_popcountll(differ));
+
+    result.Valid += __builtin_popcountll(valid);
+    result.RawOnes += __builtin_popcountll(bits & valid);
+
+    for (unsigned j = 0; j < 64; ++j) {
+      const u16 sample = samples[i + j];
+      if (sample != TRACE_INVALID_SAMPLE) ++result.Histogram[sample];
+    }
+  }
+
+  result.Baseline = baseline.GetBaseline();
+}
+
+static bool ReadTrace(const char* path, TTraceHeader& header, std::vector<u16>& samples) {
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr) {
+    fprintf(stderr, "%s: cannot open file\n", path);
+    return false;
+  }
+  if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.Magic, TRACE_MAGIC, 4) != 0) {
+    fprintf(stderr, "%s: not a raw latency trace\n", path);
+    fclose(file);
+    return false;
+  }
+  // Version 1 only differs in the meaning of SPIFrequency
+  if (header.Version < 1 || header.Version > TRACE_VERSION || header.BytesPerSample != sizeof(u16)) {
+    fprintf(stderr, "%s: unsupported trace version %u\n", path, header.Version);
+    fclose(file);
+    return false;
+  }
+  // Padding with invalid samples never yields output bits
+  samples.assign((header.SampleCount + Granule - 1) / Granule * Granule, TRACE_INVALID_SAMPLE);
+  const size_t read = fread(samples.data(), sizeof(u16), header.SampleCount, file);
+  fclose(file);
+  if (read != header.SampleCount) {
+    fprintf(stderr, "%s: truncated trace (%zu of %llu samples)\n", path, read,
+            static_cast<unsigned long long>(header.SampleCount));
+    return false;
+  }
+  return true;
+}
+
+static bool WriteOutput(const std::string& path, const std::vector<u64>& bits, const u64 count, const bool ascii) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    fprintf(stderr, "%s: cannot create file\n", path.c_str());
+    return false;
+  }
+  std::vector<u8> out;
+  if (ascii) {
+    out.resize(count);
+    for (u64 i = 0; i < count; ++i) out[i] = '0' + (bits[i / 64] >> (i % 64) & 1);
+  } else {
+    // Packed, most significant bit first
+    out.assign((count + 7) / 8, 0);
+    for (u64 i = 0; i < count; ++i) out[i / 8] |= (bits[i / 64] >> (i % 64) & 1) << (7 - i % 8);
+  }
+  const bool ok = fwrite(out.data(), 1, out.size(), file) == out.size();
+  fclose(file);
+  return ok;
+}
+
+static bool Replay(const char* path, const TOptions& options) {
+  TTraceHeader header;
+  std::vector<u16> samples;
+  if (!ReadTrace(path, header, samples)) return false;
+
+  const auto start = std::chrono::steady_clock::now();
+
+  const size_t granules = samples.size() / Granule;
+  // The median quantiser carries its baseline from sample to sample
+  const unsigned maxThreads = options.Median ? 1 : options.Threads;
+  const unsigned threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(maxThreads, granules)));
+  std::vector<TChunkResult> results(threads);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; ++t) {
+    const size_t first = granules * t / threads * Granule;
+    const size_t last = granules * (t + 1) / threads * Granule;
+    workers.emplace_back(ProcessChunk, samples.data() + first, last - first, std::cref(options),
+                         std::ref(results[t]));
+  }
+  // Meanwhile on this thread
+  TChunkResult total;
+  RunHealthTests(samples.data(), samples.size(), options, total);
+  for (auto& worker : workers) worker.join();
+
+  // Merge in order
+  total.Histogram.assign(TRACE_MAX_SAMPLE + 1, 0);
+  for (const auto& result : results) {
+    for (u64 i = 0; i < result.BitCount; i += 64) {
+      const unsigned n = static_cast<unsigned>(std::min<u64>(64, result.BitCount - i));
+      AppendBits(total.Bits, total.BitCount, result.Bits[i / 64], n);
+    }
+    total.Baseline = result.Baseline;
+    total.Valid += result.Valid;
+    total.RawOnes += result.RawOnes;
+    for (size_t i = 0; i < result.Histogram.size(); ++i) total.Histogram[i] += result.Histogram[i];
+  }
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  u64 mostCommon = 0, distinct = 0;
+  double mean = 0;
+  for (size_t i = 0; i < total.Histogram.size(); ++i) {
+    if (total.Histogram[i] == 0) continue;
+    ++distinct;
+    mostCommon = std::max(mostCommon, total.Histogram[i]);
+    mean += static_cast<double>(i) * total.Histogram[i];
+  }
+  const double valid = static_cast<double>(std::max<u64>(1, total.Valid));
+
+  printf("%s\n", path);
+  printf("  Memory type %u, %s %u Hz%s\n", header.MemType, header.Version == 1 ? "SPI clock" : "polling clock",
+         header.SPIFrequency, header.Flags & TRACE_FLAG_SPI_ASYNC ? ", asynchronous SPI (polls restarted by IRQ)" : "");
+  printf("  Samples:            %llu (%llu failed)\n", static_cast<unsigned long long>(header.SampleCount),
+         static_cast<unsigned long long>(header.SampleCount - total.Valid));
+  printf("  Latency:            mean %.3f, %llu distinct values, min-entropy %.4f bits/sample\n",
+         mean / valid, static_cast<unsigned long long>(distinct),
+         mostCommon ? -std::log2(static_cast<double>(mostCommon) / valid) : 0.0);
+  printf("  Raw bits:           %.6f ones\n", static_cast<double>(total.RawOnes) / valid);
+  if (options.Median) {
+    printf("  Quantiser:          median, final baseline %llu\n", static_cast<unsigned long long>(total.Baseline));
+  }
+  printf("  Extracted bits:     %llu (%.4f per valid sample)\n", static_cast<unsigned long long>(total.BitCount),
+         static_cast<double>(total.BitCount) / valid);
+  printf("  Health failures:    RCT %u, APT %u\n", total.RCTFailures, total.APTFailures);
+  printf("  Replay:             %.3f ms, %.2f GB/s, %u threads\n", seconds * 1e3,
+         static_cast<double>(header.SampleCount * sizeof(u16)) / seconds / 1e9, threads);
+
+  bool ok = true;
+  if (options.WritePacked) ok &= WriteOutput(std::string(path) + ".bits", total.Bits, total.BitCount, false);
+  if (options.WriteAscii) ok &= WriteOutput(std::string(path) + "_bits.log", total.Bits, total.BitCount, true);
+  return ok;
+}
+
+static void Usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options] trace.bin...\n"
+          "  -t <n>       Number of threads (default: all cores)\n"
+          "  -s           Use the scalar kernel code only (no SIMD)\n"
+          "  -m           Quantise against the drift-tracking median baseline (quantiser=median, single thread)\n"
+          "  -w           Write the extracted bits packed (MSB first) to <trace>.bits\n"
+          "  -a           Write the extracted bits as ASCII to <trace>_bits.log (like trng mode)\n"
+          "  -r <cutoff>  Repetition count test cutoff (default: %u)\n"
+          "  -p <cutoff>  Adaptive proportion test cutoff (default: %u)\n"
+          "  -W <window>  Adaptive proportion test window (default: %u)\n",
+          program, HEALTH_RCT_CUTOFF, HEALTH_APT_CUTOFF, HEALTH_APT_WINDOW);
+}
+
+int main(int argc, char** argv) {
+  TOptions options;
+  std::vector<const char*> files;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "-t" && hasValue) {
+      options.Threads = std::max(1, atoi(argv[++i]));
+    } else if (arg == "-s") {
+      options.Scalar = true;
+    } else if (arg == "-m") {
+      options.Median = true;
+    } else if (arg == "-w") {
+      options.WritePacked = true;
+    } else if (arg == "-a") {
+      options.WriteAscii = true;
+    } else if (arg == "-r" && hasValue) {
+      options.RCTCutoff = static_cast<unsigned>(atoi(argv[++i]));
+    } else if (arg == "-p" && hasValue) {
+      options.APTCutoff = static_cast<unsigned>(atoi(argv[++i]));
+    } else if (arg == "-W" && hasValue) {
+      options.APTWindow = static_cast<unsigned>(atoi(argv[++i]));
+    } else if (arg[0] == '-') {
+      Usage(argv[0]);
+      return 2;
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+  if (files.empty()) {
+    Usage(argv[0]);
+    return 2;
+  }
+
+  int status = 0;
+  for (const char* file : files) {
+    if (!Replay(file, options)) status = 1;
+  }
+  return status;
+}
@@ -0,0 +1,534 @@
+//
+// stattest.cpp
+//
+// Runs a core set of the NIST SP 800-22 statistical tests over TRNG output files (ASCII *_bits.log or packed bits)
+// and prints a pass/fail summary per file. Files and tests are spread across all cores.
+//
+#include <circle/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct TOptions {
+  unsigned Threads = std::max(1u, std::thread::hardware_concurrency());
+  double Alpha = 0.01;
+  unsigned BlockFrequencyM = 128;
+  int SerialM = -1;  // -1: largest recommended up to 16
+  int ApEnM = -1;    // -1: largest recommended up to 10
+  bool ForcePacked = false;
+  bool ForceAscii = false;
+};
+
+// Bit i of the sequence is bit i % 64 of word i / 64
+struct TBits {
+  std::vector<u64> Words;
+  u64 Count = 0;
+
+  unsigned Get(const u64 i) const {
+    return Words[i / 64] >> (i % 64) & 1;
+  }
+
+  u8 GetByte(const u64 i) const {
+    return static_cast<u8>(Words[i / 64] >> (i % 64 / 8 * 8));
+  }
+};
+
+struct TResult {
+  const char* Name;
+  std::vector<double> PValues;
+  std::string Note;
+};
+
+// Per-byte lookup tables (bits in sequence order, i.e. LSB first)
+struct TByteTables {
+  s8 Sum[256];         // Sum of +1/-1
+  s8 MaxPrefix[256];   // Maximum partial sum
+  s8 MinPrefix[256];   // Minimum partial sum
+  s8 MaxPrefixRev[256];
+  s8 MinPrefixRev[256];
+  u8 LeadingOnes[256]; // Ones at the start of the byte
+  u8 TrailingOnes[256];
+  u8 LongestRun[256];
+
+  TByteTables() {
+    for (unsigned b = 0; b < 256; ++b) {
+      int sum = 0, maxPrefix = -9, minPrefix = 9;
+      int run = 0, longest = 0;
+      for (unsigned i = 0; i < 8; ++i) {
+        const int bit = b >> i & 1;
+        sum += bit ? 1 : -1;
+        maxPrefix = std::max(maxPrefix, sum);
+        minPrefix = std::min(minPrefix, sum);
+        run = bit ? run + 1 : 0;
+        longest = std::max(longest, run);
+      }
+      Sum[b] = static_cast<s8>(sum);
+      MaxPrefix[b] = static_cast<s8>(maxPrefix);
+      MinPrefix[b] = static_cast<s8>(minPrefix);
+      LongestRun[b] = static_cast<u8>(longest);
+
+      sum = 0, maxPrefix = -9, minPrefix = 9;
+      for (int i = 7; i >= 0; --i) {
+        sum += (b >> i & 1) ? 1 : -1;
+        maxPrefix = std::max(maxPrefix, sum);
+        minPrefix = std::min(minPrefix, sum);
+      }
+      MaxPrefixRev[b] = static_cast<s8>(maxPrefix);
+      MinPrefixRev[b] = static_cast<s8>(minPrefix);
+
+      unsigned leading = 0, trailing = 0;
+      while (leading < 8 && (b >> leading & 1)) ++leading;
+      while (trailing < 8 && (b >> (7 - trailing) & 1)) ++trailing;
+      LeadingOnes[b] = static_cast<u8>(leading);
+      TrailingOnes[b] = static_cast<u8>(trailing);
+    }
+  }
+};
+
+static const TByteTables Tables;
+
+// Incomplete gamma functions (after Cephes)
+
+static constexpr double MachEp = 1.11022302462515654042e-16;
+static constexpr double Big = 4.503599627370496e15;
+static constexpr double BigInv = 2.22044604925031308085e-16;
+
+static double IGamc(double a, double x);
+
+static double IGam(const double a, const double x) {
+  if (x <= 0 || a <= 0) return 0.0;
+  if (x > 1.0 && x > a) return 1.0 - IGamc(a, x);
+
+  const double ax = a * std::log(x) - x - std::lgamma(a);
+  if (ax < -709.78) return 0.0;
+
+  double r = a, c = 1.0, ans = 1.0;
+  do {
+    r += 1.0;
+    c *= x / r;
+    ans += c;
+  } while (c / ans > MachEp);
+  return ans * std::exp(ax) / a;
+}
+
+static double IGamc(const double a, const double x) {
+  if (x <= 0 || a <= 0) return 1.0;
+  if (x < 1.0 || x < a) return 1.0 - IGam(a, x);
+
+  const double ax = a * std::log(x) - x - std::lgamma(a);
+  if (ax < -709.78) return 0.0;
+
+  double y = 1.0 - a, z = x + y + 1.0, c = 0.0;
+  double pkm2 = 1.0, qkm2 = x, pkm1 = x + 1.0, qkm1 = z * x;
+  double ans = pkm1 / qkm1, t;
+  do {
+    c += 1.0;
+    y += 1.0;
+    z += 2.0;
+    const double yc = y * c;
+    const double pk = pkm1 * z - pkm2 * yc;
+    const double qk = qkm1 * z - qkm2 * yc;
+    if (qk != 0) {
+      const double r = pk / qk;
+      t = std::fabs((ans - r) / r);
+      ans = r;
+    } else {
+      t = 1.0;
+    }
+    pkm2 = pkm1;
+    pkm1 = pk;
+    qkm2 = qkm1;
+    qkm1 = qk;
+    if (std::fabs(pk) > Big) {
+      pkm2 *= BigInv;
+      pkm1 *= BigInv;
+      qkm2 *= BigInv;
+      qkm1 *= BigInv;
+    }
+  } while (t > MachEp);
+  return ans * std::exp(ax);
+}
+
+static double Normal(const double x) {
+  return 0.5 * std::erfc(-x / std::sqrt(2.0));
+}
+
+static u64 CountOnes(const TBits& bits, const u64 first, const u64 count) {
+  u64 ones = 0;
+  u64 i = first;
+  const u64 last = first + count;
+  while (i < last && i % 64) ones += bits.Get(i++);
+  for (; i + 64 <= last; i += 64) ones += __builtin_popcountll(bits.Words[i / 64]);
+  while (i < last) ones += bits.Get(i++);
+  return ones;
+}
+
+// Tests
+
+static TResult Frequency(const TBits& bits, const TOptions&) {
+  const double n = static_cast<double>(bits.Count);
+  const double s = 2.0 * static_cast<double>(CountOnes(bits, 0, bits.Count)) - n;
+  return {"Frequency", {std::erfc(std::fabs(s) / std::sqrt(n) / std::sqrt(2.0))}, ""};
+}
+
+static TResult BlockFrequency(const TBits& bits, const TOptions& options) {
+  const u64 m = options.BlockFrequencyM;
+  const u64 blocks = bits.Count / m;
+  double chi = 0;
+  for (u64 i = 0; i < blocks; ++i) {
+    const double pi = static_cast<double>(CountOnes(bits, i * m, m)) / static_cast<double>(m);
+    chi += (pi - 0.5) * (pi - 0.5);
+  }
+  chi *= 4.0 * static_cast<double>(m);
+  return {"BlockFrequency", {IGamc(static_cast<double>(blocks) / 2.0, chi / 2.0)}, "M=" + std::to_string(m)};
+}
+
+static TResult Runs(const TBits& bits, const TOptions&) {
+  const u64 n = bits.Count;
+  const double pi = static_cast<double>(CountOnes(bits, 0, n)) / static_cast<double>(n);
+  if (std::fabs(pi - 0.5) >= 2.0 / std::sqrt(static_cast<double>(n))) {
+    return {"Runs", {0.0}, "frequency prerequisite failed"};
+  }
+
+  // Every position where bit i differs from bit i + 1 starts a new run
+  u64 transitions = 0;
+  const u64 words = bits.Words.size();
+  for (u64 w = 0; w < words; ++w) {
+    const u64 next = w + 1 < words ? bits.Words[w + 1] : 0;
+    u64 diff = bits.Words[w] ^ (bits.Words[w] >> 1 | next << 63);
+    const u64 valid = std::min<u64>(64, n - 1 - std::min(n - 1, w * 64));
+    if (valid < 64) diff &= (static_cast<u64>(1) << valid) - 1;
+    transitions += __builtin_popcountll(diff);
+  }
+  const double v = static_cast<double>(transitions + 1);
+  const double nd = static_cast<double>(n);
+  const double p = std::erfc(std::fabs(v - 2.0 * nd * pi * (1.0 - pi)) / (2.0 * std::sqrt(2.0 * nd) * pi * (1.0 - pi)));
+  return {"Runs", {p}, ""};
+}
+
+static TResult LongestRun(const TBits& bits, const TOptions&) {
+  const u64 n = bits.Count;
+  u64 m;
+  unsigned k, lowest;
+  std::vector<double> pi;
+  if (n < 128) {
+    return {"LongestRun", {}, "needs at least 128 bits"};
+  } else if (n < 6272) {
+    m = 8, k = 3, lowest = 1;
+    pi = {0.21484375, 0.3671875, 0.23046875, 0.1875};
+  } else if (n < 750000) {
+    m = 128, k = 5, lowest = 4;
+    pi = {0.1174035788, 0.242955959, 0.249363483, 0.17517706, 0.102701071, 0.112398847};
+  } else {
+    m = 10000, k = 6, lowest = 10;
+    pi = {0.0882, 0.2092, 0.2483, 0.1933, 0.1208, 0.0675, 0.0727};
+  }
+
+  const u64 blocks = n / m;
+  std::vector<u64> v(k + 1, 0);
+  for (u64 b = 0; b < blocks; ++b) {
+    unsigned run = 0, longest = 0;
+    for (u64 i = b * m; i < (b + 1) * m; i += 8) {
+      const u8 byte = bits.GetByte(i);
+      if (byte == 0xFF) {
+        run += 8;
+      } else {
+        longest = std::max({longest, run + Tables.LeadingOnes[byte], static_cast<unsigned>(Tables.LongestRun[byte])});
+        run = Tables.TrailingOnes[byte];
+      }
+      longest = std::max(longest, run);
+    }
+    const unsigned cls = std::min(k, longest < lowest ? 0 : longest - lowest);
+    ++v[cls];
+  }
+
+  double chi = 0;
+  for (unsigned i = 0; i <= k; ++i) {
+    const double expected = static_cast<double>(blocks) * pi[i];
+    chi += (static_cast<double>(v[i]) - expected) * (static_cast<double>(v[i]) - expected) / expected;
+  }
+  return {"LongestRun", {IGamc(k / 2.0, chi / 2.0)}, "M=" + std::to_string(m)};
+}
+
+// Counts all overlapping (cyclic) m bit patterns, first bit as MSB
+static std::vector<u64> CountPatterns(const TBits& bits, const unsigned m) {
+  std::vector<u64> counts(static_cast<size_t>(1) << m, 0);
+  const u64 mask = (static_cast<u64>(1) << m) - 1;
+  const u64 n = bits.Count;
+  u64 window = 0;
+  for (unsigned i = 0; i < m - 1; ++i) window = window << 1 | bits.Get(i);
+  u64 i = m - 1;
+  for (; i < n; ++i) {
+    window = (window << 1 | bits.Get(i)) & mask;
+    ++counts[window];
+  }
+  for (u64 j = 0; j < m - 1; ++j) {
+    window = (window << 1 | bits.Get(j)) & mask;
+    ++counts[window];
+  }
+  return counts;
+}
+
+// Counts of m - 1 bit patterns from the counts of m bit patterns (exact for cyclic counting)
+static std::vector<u64> FoldPatterns(const std::vector<u64>& counts) {
+  std::vector<u64> folded(counts.size() / 2);
+  for (size_t p = 0; p < folded.size(); ++p) folded[p] = counts[2 * p] + counts[2 * p + 1];
+  return folded;
+}
+
+static unsigned FloorLog2(const u64 n) {
+  return 63 - __builtin_clzll(n);
+}
+
+static TResult Serial(const TBits& bits, const TOptions& options) {
+  const u64 n = bits.Count;
+  const int recommended = static_cast<int>(FloorLog2(n)) - 3;
+  const int m = options.SerialM > 0 ? options.SerialM : std::min(16, recommended);
+  if (m < 3) return {"Serial", {}, "sequence too short"};
+
+  auto psi = [n](const std::vector<u64>& counts) {
+    double sum = 0;
+    for (const u64 c : counts) sum += static_cast<double>(c) * static_cast<double>(c);
+    return sum * static_cast<double>(counts.size()) / static_cast<double>(n) - static_cast<double>(n);
+  };
+
+  const auto countsM = CountPatterns(bits, m);
+  const auto countsM1 = FoldPatterns(countsM);
+  const auto countsM2 = FoldPatterns(countsM1);
+  const double psiM = psi(countsM), psiM1 = psi(countsM1), psiM2 = psi(countsM2);
+  const double del1 = psiM - psiM1;
+  const double del2 = psiM - 2.0 * psiM1 + psiM2;
+  return {"Serial", {IGamc(std::pow(2.0, m - 2), del1 / 2.0), IGamc(std::pow(2.0, m - 3), del2 / 2.0)},
+          "m=" + std::to_string(m)};
+}
+
+static TResult ApproximateEntropy(const TBits& bits, const TOptions& options) {
+  const u64 n = bits.Count;
+  const int recommended = static_cast<int>(FloorLog2(n)) - 6;
+  const int m = options.ApEnM > 0 ? options.ApEnM : std::min(10, recommended);
+  if (m < 1) return {"ApproximateEntropy", {}, "sequence too short"};
+
+  auto phi = [n](const std::vector<u64>& counts) {
+    double sum = 0;
+    for (const u64 c : counts) {
+      if (c == 0) continue;
+      const double p = static_cast<double>(c) / static_cast<double>(n);
+      sum += p * std::log(p);
+    }
+    return sum;
+  };
+
+  const auto countsM1 = CountPatterns(bits, m + 1);
+  const auto countsM = FoldPatterns(countsM1);
+  const double apEn = phi(countsM) - phi(countsM1);
+  const double chi = 2.0 * static_cast<double>(n) * (std::log(2.0) - apEn);
+  return {"ApproximateEntropy", {IGamc(std::pow(2.0, m - 1), chi / 2.0)}, "m=" + std::to_string(m)};
+}
+
+static double CusumPValue(const double n, const double z) {
+  const double sqrtN = std::sqrt(n);
+  double sum1 = 0, sum2 = 0;
+  for (int k = static_cast<int>((-n / z + 1) / 4); k <= static_cast<int>((n / z - 1) / 4); ++k) {
+    sum1 += Normal((4 * k + 1) * z / sqrtN) - Normal((4 * k - 1) * z / sqrtN);
+  }
+  for (int k = static_cast<int>((-n / z - 3) / 4); k <= static_cast<int>((n / z - 1) / 4); ++k) {
+    sum2 += Normal((4 * k + 3) * z / sqrtN) - Normal((4 * k + 1) * z / sqrtN);
+  }
+  return 1.0 - sum1 + sum2;
+}
+
+static TResult CumulativeSums(const TBits& bits, const TOptions&) {
+  const u64 n = bits.Count;
+  const u64 full = n / 8 * 8;
+
+  // Forward
+  s64 s = 0, zForward = 0;
+  for (u64 i = 0; i < full; i += 8) {
+    const u8 byte = bits.GetByte(i);
+    zForward = std::max({zForward, s + Tables.MaxPrefix[byte], -(s + Tables.MinPrefix[byte])});
+    s += Tables.Sum[byte];
+  }
+  for (u64 i = full; i < n; ++i) {
+    s += bits.Get(i) ? 1 : -1;
+    zForward = std::max(zForward, s < 0 ? -s : s);
+  }
+
+  // Backward
+  s64 r = 0, zBackward = 0;
+  for (u64 i = n; i > full; --i) {
+    r += bits.Get(i - 1) ? 1 : -1;
+    zBackward = std::max(zBackward, r < 0 ? -r : r);
+  }
+  for (u64 i = full; i > 0; i -= 8) {
+    const u8 byte = bits.GetByte(i - 8);
+    zBackward = std::max({zBackward, r + Tables.MaxPrefixRev[byte], -(r + Tables.MinPrefixRev[byte])});
+    r += Tables.Sum[byte];
+  }
+
+  const double nd = static_cast<double>(n);
+  return {"CumulativeSums",
+          {CusumPValue(nd, static_cast<double>(zForward)), CusumPValue(nd, static_cast<double>(zBackward))},
+          "forward, backward"};
+}
+
+typedef TResult TTest(const TBits& bits, const TOptions& options);
+
+static TTest* const Tests[] = {
+  Frequency, BlockFrequency, Runs, LongestRun, Serial, ApproximateEntropy, CumulativeSums
+};
+static constexpr unsigned TestCount = sizeof(Tests) / sizeof(Tests[0]);
+
+// Input
+
+static bool ReadBits(const char* path, const TOptions& options, TBits& bits) {
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr) return false;
+  std::vector<u8> data;
+  u8 buffer[1 << 16];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) data.insert(data.end(), buffer, buffer + read);
+  fclose(file);
+
+  bool ascii = !options.ForcePacked;
+  if (ascii && !options.ForceAscii) {
+    for (const u8 c : data) {
+      if (c != '0' && c != '1' && c != '\n' && c != '\r' && c != ' ') {
+        ascii = false;
+        break;
+      }
+    }
+  }
+
+  if (ascii) {
+    bits.Words.assign(data.size() / 64 + 1, 0);
+    for (const u8 c : data) {
+      if (c != '0' && c != '1') continue;
+      bits.Words[bits.Count / 64] |= static_cast<u64>(c - '0') << (bits.Count % 64);
+      ++bits.Count;
+    }
+  } else {
+    // Packed, most significant bit first
+    bits.Count = data.size() * 8;
+    bits.Words.assign(data.size() / 8 + 1, 0);
+    for (size_t i = 0; i < data.size(); ++i) {
+      u8 b = data[i];
+      b = static_cast<u8>((b & 0xF0) >> 4 | (b & 0x0F) << 4);
+      b = static_cast<u8>((b & 0xCC) >> 2 | (b & 0x33) << 2);
+      b = static_cast<u8>((b & 0xAA) >> 1 | (b & 0x55) << 1);
+      bits.Words[i / 8] |= static_cast<u64>(b) << (i % 8 * 8);
+    }
+  }
+  bits.Words.resize(bits.Count / 64 + 1);
+  return true;
+}
+
+static void Usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options] file...\n"
+          "  -t <n>      Number of threads (default: all cores)\n"
+          "  -a <alpha>  Significance level (default: 0.01)\n"
+          "  -M <m>      Block frequency block length (default: 128)\n"
+          "  -m <m>      Serial test pattern length (default: largest recommended up to 16)\n"
+          "  -e <m>      Approximate entropy pattern length (default: largest recommended up to 10)\n"
+          "  -b          Treat input as packed bits (MSB first) instead of detecting the format\n"
+          "  -c          Treat input as ASCII '0'/'1'\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  TOptions options;
+  std::vector<const char*> paths;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "-t" && hasValue) {
+      options.Threads = std::max(1, atoi(argv[++i]));
+    } else if (arg == "-a" && hasValue) {
+      options.Alpha = atof(argv[++i]);
+    } else if (arg == "-M" && hasValue) {
+      options.BlockFrequencyM = std::max(1, atoi(argv[++i]));
+    } else if (arg == "-m" && hasValue) {
+      options.SerialM = atoi(argv[++i]);
+    } else if (arg == "-e" && hasValue) {
+      options.ApEnM = atoi(argv[++i]);
+    } else if (arg == "-b") {
+      options.ForcePacked = true;
+    } else if (arg == "-c") {
+      options.ForceAscii = true;
+    } else if (arg[0] == '-') {
+      Usage(argv[0]);
+      return 2;
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty()) {
+    Usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<TBits> files(paths.size());
+  std::vector<char> loaded(paths.size()); // Not vector<bool>: the loader threads write neighbouring flags concurrently
+  std::vector<TResult> results(paths.size() * TestCount);
+
+  // Load all files, then run every (file, test) pair as an independent task
+  std::atomic<size_t> next(0);
+  auto loader = [&]() {
+    for (size_t f; (f = next++) < paths.size();) loaded[f] = ReadBits(paths[f], options, files[f]);
+  };
+  auto runner = [&]() {
+    for (size_t task; (task = next++) < results.size();) {
+      const size_t f = task / TestCount;
+      if (!loaded[f] || files[f].Count == 0) continue;
+      results[task] = Tests[task % TestCount](files[f], options);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < options.Threads; ++t) workers.emplace_back(loader);
+  for (auto& worker : workers) worker.join();
+  workers.clear();
+  next = 0;
+  for (unsigned t = 0; t < options.Threads; ++t) workers.emplace_back(runner);
+  for (auto& worker : workers) worker.join();
+
+  unsigned failedFiles = 0;
+  for (size_t f = 0; f < paths.size(); ++f) {
+    if (!loaded[f] || files[f].Count == 0) {
+      printf("%s: cannot read bits\n\n", paths[f]);
+      ++failedFiles;
+      continue;
+    }
+    printf("%s (%llu bits)\n", paths[f], static_cast<unsigned long long>(files[f].Count));
+    unsigned passed = 0, total = 0;
+    for (unsigned t = 0; t < TestCount; ++t) {
+      const TResult& result = results[f * TestCount + t];
+      if (result.PValues.empty()) {
+        printf("  %-20s %-22s %s\n", result.Name, "", result.Note.c_str());
+        continue;
+      }
+      bool pass = true;
+      std::string values;
+      for (const double p : result.PValues) {
+        char value[16];
+        snprintf(value, sizeof(value), "%s%.6f", values.empty() ? "" : " ", p);
+        values += value;
+        pass &= p >= options.Alpha;
+      }
+      ++total;
+      passed += pass;
+      printf("  %-20s %-22s %-4s %s\n", result.Name, values.c_str(), pass ? "PASS" : "FAIL", result.Note.c_str());
+    }
+    printf("  => %u/%u tests passed\n\n", passed, total);
+    if (passed != total) ++failedFiles;
+  }
+
+  printf("%zu files, %u failed\n", paths.size(), failedFiles);
+  return failedFiles ? 1 : 0;
+}
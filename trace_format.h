@@ -0,0 +1,27 @@
+#pragma once
+
+#include <circle/types.h>
+
+#define TRACE_MAGIC            "RLT1"
+#define TRACE_VERSION          2 // 1: SPIFrequency is the common clock of all commands
+#define TRACE_INVALID_SAMPLE   0
+#define TRACE_MAX_SAMPLE       0xFFFF
+
+#define TRACE_FLAG_SPI_ASYNC   (1 << 0) // Polls restarted from the DMA interrupt, latencies span more time
+
+// Header of the raw latency trace files (trace mode), followed by SampleCount little-endian u16 latencies.
+// A latency of TRACE_INVALID_SAMPLE marks a failed measurement; larger latencies are saturated.
+struct TTraceHeader {
+  char Magic[4];
+  u16 Version;
+  u16 BytesPerSample;
+  u32 MemType;
+  u32 SPIFrequency; // RDSR polling clock, which determines the latency resolution
+  u64 SampleCount;
+  u32 Flags;        // TRACE_FLAG_*; 0 in traces before the flags were introduced
+  u32 Reserved;
+} __attribute__((packed));
+
+inline u16 EncodeTraceSample(const u64 latency) {
+  return static_cast<u16>(latency > TRACE_MAX_SAMPLE ? TRACE_MAX_SAMPLE : latency);
+}
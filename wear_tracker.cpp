@@ -0,0 +1,133 @@
+//
+// wear_tracker.cpp
+//
+#include "wear_tracker.h"
+
+#include <circle/util.h>
+
+#define WEAR_IO_CHUNK  2048 // Counters per f_read/f_write
+
+// <file>.tmp
+static bool GetTempName(char* pBuffer, const unsigned nSize, const char* pFileName) {
+  const unsigned nLength = strlen(pFileName);
+  if (nLength + 5 > nSize) return false;
+  memcpy(pBuffer, pFileName, nLength);
+  memcpy(pBuffer + nLength, ".tmp", 5);
+  return true;
+}
+
+CWearTracker::CWearTracker(const u32 nCells)
+  : m_nCells(nCells),
+    m_pCounters(new u16[nCells]),
+    m_nScaleShift(0),
+    m_nTotalWrites(0),
+    m_nRandom(0x9E3779B97F4A7C15) {
+  memset(m_pCounters, 0, nCells * sizeof(u16));
+}
+
+CWearTracker::~CWearTracker() {
+  delete[] m_pCounters;
+}
+
+u64 CWearTracker::GetWrites(const u32 nAddress) const {
+  return static_cast<u64>(m_pCounters[nAddress]) << m_nScaleShift;
+}
+
+u64 CWearTracker::GetMaxWrites() const {
+  u16 max = 0;
+  for (u32 i = 0; i < m_nCells; ++i) {
+    if (m_pCounters[i] > max) max = m_pCounters[i];
+  }
+  return static_cast<u64>(max) << m_nScaleShift;
+}
+
+u64 CWearTracker::GetTotalWrites() const {
+  return m_nTotalWrites;
+}
+
+FRESULT CWearTracker::Load(const char* pFileName) {
+  FIL file;
+  FRESULT Result = f_open(&file, pFileName, FA_READ | FA_OPEN_EXISTING);
+  if (Result == FR_NO_FILE) {
+    // Save removes the file only once the temporary file is complete
+    char tempName[256];
+    if (!GetTempName(tempName, sizeof(tempName), pFileName)) return FR_INVALID_NAME;
+    Result = f_open(&file, tempName, FA_READ | FA_OPEN_EXISTING);
+    if (Result == FR_NO_FILE) return FR_OK;
+  }
+  if (Result != FR_OK) return Result;
+
+  TWearHeader header;
+  unsigned nBytesRead;
+  Result = f_read(&file, &header, sizeof(header), &nBytesRead);
+  if (Result == FR_OK && (nBytesRead != sizeof(header) || memcmp(header.Magic, WEAR_MAGIC, 4) != 0
+                          || header.Version != WEAR_VERSION || header.MemType != MEM_TYPE
+                          || header.Cells != m_nCells)) {
+    Result = FR_INVALID_OBJECT;
+  }
+  if (Result != FR_OK) {
+    f_close(&file);
+    return Result;
+  }
+
+  // Bring both to the coarser scale, then add
+  while (m_nScaleShift < header.ScaleShift) Halve();
+  const unsigned nFileShift = m_nScaleShift - header.ScaleShift;
+
+  u16 chunk[WEAR_IO_CHUNK];
+  for (u32 i = 0; i < m_nCells && Result == FR_OK;) {
+    u32 nCount = m_nCells - i;
+    if (nCount > WEAR_IO_CHUNK) nCount = WEAR_IO_CHUNK;
+    Result = f_read(&file, chunk, nCount * sizeof(u16), &nBytesRead);
+    if (Result == FR_OK && nBytesRead != nCount * sizeof(u16)) Result = FR_INVALID_OBJECT;
+    for (u32 j = 0; j < nCount && Result == FR_OK; ++j, ++i) {
+      const u32 sum = m_pCounters[i] + (chunk[j] >> nFileShift);
+      m_pCounters[i] = static_cast<u16>(sum > WEAR_COUNTER_MAX ? WEAR_COUNTER_MAX : sum);
+    }
+  }
+  m_nTotalWrites += header.TotalWrites;
+
+  const FRESULT CloseResult = f_close(&file);
+  return Result != FR_OK ? Result : CloseResult;
+}
+
+FRESULT CWearTracker::Save(const char* pFileName) const {
+  char tempName[256];
+  if (!GetTempName(tempName, sizeof(tempName), pFileName)) return FR_INVALID_NAME;
+
+  FIL file;
+  FRESULT Result = f_open(&file, tempName, FA_WRITE | FA_CREATE_ALWAYS);
+  if (Result != FR_OK) return Result;
+
+  const TWearHeader header = {
+    {WEAR_MAGIC[0], WEAR_MAGIC[1], WEAR_MAGIC[2], WEAR_MAGIC[3]},
+    WEAR_VERSION,
+    static_cast<u16>(m_nScaleShift),
+    MEM_TYPE,
+    m_nCells,
+    m_nTotalWrites
+  };
+  unsigned nBytesWritten;
+  Result = f_write(&file, &header, sizeof(header), &nBytesWritten);
+  if (Result == FR_OK && nBytesWritten != sizeof(header)) Result = FR_DENIED;
+  if (Result == FR_OK) {
+    Result = f_write(&file, m_pCounters, m_nCells * sizeof(u16), &nBytesWritten);
+    if (Result == FR_OK && nBytesWritten != m_nCells * sizeof(u16)) Result = FR_DENIED; // Disk full
+  }
+  const FRESULT CloseResult = f_close(&file);
+  if (Result == FR_OK) Result = CloseResult;
+  if (Result != FR_OK) return Result;
+
+  // Keeps the previous counters if the power is cut while writing; Load falls back to the temporary
+  // file if it is cut between unlink and rename
+  Result = f_unlink(pFileName);
+  if (Result != FR_OK && Result != FR_NO_FILE) return Result;
+  return f_rename(tempName, pFileName);
+}
+
+void CWearTracker::Halve() {
+  for (u32 i = 0; i < m_nCells; ++i) {
+    m_pCounters[i] >>= 1;
+  }
+  ++m_nScaleShift;
+}
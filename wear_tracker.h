@@ -0,0 +1,77 @@
+#pragma once
+
+#include <circle/types.h>
+#include <fatfs/ff.h>
+
+#define WEAR_MAGIC            "WEAR"
+#define WEAR_VERSION          1
+#define WEAR_COUNTER_MAX      0xFFFF
+
+// Header of the persisted wear counters, followed by Cells little-endian u16 counters
+struct TWearHeader {
+  char Magic[4];
+  u16 Version;
+  u16 ScaleShift;
+  u32 MemType;
+  u32 Cells;
+  u64 TotalWrites;
+} __attribute__((packed));
+
+/**
+ * Approximate number of writes per memory cell.
+ * Every cell has a saturating 16 bit counter of writes >> scale shift. Once a counter saturates,
+ * all counters are halved and the scale shift is incremented, so the order of the cells is kept.
+ * From then on a write is counted with probability 2^-shift, so a count still stands for 2^shift writes on
+ * average. The decision is random rather than every 2^shift-th write, which would be phase-locked to chains and
+ * access patterns and leave some cells uncounted; it has its own generator so genrand sequences are unchanged.
+ */
+class CWearTracker {
+public:
+  explicit CWearTracker(u32 nCells);
+
+  ~CWearTracker();
+
+  void RecordWrite(u32 nAddress) {
+    ++m_nTotalWrites;
+    if (m_nScaleShift != 0 && (NextRandom() & ((1ull << m_nScaleShift) - 1)) != 0) return;
+    if (m_pCounters[nAddress] == WEAR_COUNTER_MAX) Halve();
+    ++m_pCounters[nAddress];
+  }
+
+  // Power of two choices: returns the less worn of both addresses
+  u32 SelectAddress(u32 nAddress1, u32 nAddress2) const {
+    return m_pCounters[nAddress2] < m_pCounters[nAddress1] ? nAddress2 : nAddress1;
+  }
+
+  // Approximate number of writes to this cell
+  u64 GetWrites(u32 nAddress) const;
+
+  u64 GetMaxWrites() const;
+
+  u64 GetTotalWrites() const;
+
+  // Adds the counters stored in the file (or its temporary file, if a save was cut off before the rename);
+  // a missing file is not an error, a mismatching one is FR_INVALID_OBJECT
+  FRESULT Load(const char* pFileName);
+
+  // Replaces the file (written to a temporary file first)
+  FRESULT Save(const char* pFileName) const;
+
+private:
+  void Halve();
+
+  // xorshift64
+  u64 NextRandom() {
+    m_nRandom ^= m_nRandom << 13;
+    m_nRandom ^= m_nRandom >> 7;
+    m_nRandom ^= m_nRandom << 17;
+    return m_nRandom;
+  }
+
+private:
+  u32 m_nCells;
+  u16* m_pCounters;
+  unsigned m_nScaleShift;
+  u64 m_nTotalWrites;
+  u64 m_nRandom;
+};